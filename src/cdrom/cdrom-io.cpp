@@ -91,6 +91,8 @@ void cdrom_t::io_write_port_2_0(uint8_t data) {
 void cdrom_t::io_write_port_2_1(uint8_t data) {
   int32_t flags = data & 0x1f;
   interrupt_enable = flags;
+
+  update_irq();
 }
 
 
@@ -118,6 +120,8 @@ void cdrom_t::io_write_port_3_1(uint8_t data) {
   int32_t flags = data & 0x1f;
   interrupt_request &= ~flags;
 
+  update_irq();
+
   if (data & 0x40) {
     parameter_fifo.clear();
   }
@@ -3,36 +3,95 @@
 #include "utility.hpp"
 
 
-cdrom_t::cdrom_t(interrupt_access_t *irq, const char *game_file_name)
+cdrom_t::cdrom_t(interrupt_access_t *irq, scheduler_t *scheduler, const char *game_file_name)
     : memory_component_t("cdc")
     , irq(irq)
+    , scheduler(scheduler)
     , game_file_name(game_file_name) {
 
   game_file = fopen(game_file_name, "rb+");
 
+  interrupt_line = 0;
+
+  logic.event = scheduler->add([this]() { (*this.*logic.stage)(); });
+  drive.event = scheduler->add([this]() { (*this.*drive.stage)(); });
+
   logic_transition(&cdrom_t::logic_idling, 1000);
   drive_transition(&cdrom_t::drive_idling, 1000);
 }
 
-void cdrom_t::tick() {
-  drive.timer--;
+void cdrom_t::serialize(state_t &state) {
+  state.io(index);
+  state.io(interrupt_enable);
+  state.io(interrupt_request);
+  state.io(interrupt_line);
+  state.io(seek_timecode);
+  state.io(read_timecode);
+  state.io(seek_unprocessed);
+  state.io(parameter_fifo);
+  state.io(response_fifo);
+  state.io(data_fifo);
+  state.io(data_buffer);
+  state.io(command);
+  state.io(command_unprocessed);
+  state.io(busy);
+  state.io(is_seeking);
+  state.io(is_reading);
+  state.io(logic.interrupt_request);
+  state.io(logic.parameter_fifo);
+  state.io(logic.response_fifo);
+  state.io(logic.command);
+  state.io(mode);
+
+  serialize_stage(state, logic.stage);
+  serialize_stage(state, drive.stage);
+}
+
+
+void cdrom_t::serialize_stage(state_t &state, stage_t &stage) {
+  // stages are member function pointers, which are saved as their position
+  // in this table.
+
+  static const stage_t stages[] = {
+    &cdrom_t::logic_idling,
+    &cdrom_t::logic_transferring_parameters,
+    &cdrom_t::logic_transferring_command,
+    &cdrom_t::logic_executing_command,
+    &cdrom_t::logic_clearing_response,
+    &cdrom_t::logic_transferring_response,
+    &cdrom_t::logic_deliver_interrupt,
+    &cdrom_t::drive_idling,
+    &cdrom_t::drive_int2,
+    &cdrom_t::drive_getting_id,
+    &cdrom_t::drive_reading
+  };
+
+  const int32_t count = int32_t(sizeof(stages) / sizeof(stages[0]));
+
+  int32_t index = 0;
 
-  if (drive.timer == 0) {
-    (*this.*drive.stage)();
+  while (index < count - 1 && stages[index] != stage) {
+    index++;
   }
 
-  logic.timer--;
+  state.io(index);
 
-  if (logic.timer == 0) {
-    (*this.*logic.stage)();
+  if (index >= 0 && index < count) {
+    stage = stages[index];
   }
+}
 
-  if (interrupt_request) {
-    int32_t signal = interrupt_request & interrupt_enable;
-    if (signal == interrupt_request) {
-      irq->send(interrupt_type_t::CDROM);
-    }
+
+void cdrom_t::update_irq() {
+  // the interrupt is only sent on the rising edge of the line
+
+  bool line = interrupt_request && (interrupt_request & interrupt_enable) == interrupt_request;
+
+  if (line && !interrupt_line) {
+    irq->send(interrupt_type_t::CDROM);
   }
+
+  interrupt_line = line;
 }
 
 uint8_t cdrom_t::get_status_byte() {
@@ -217,7 +276,8 @@ void cdrom_t::command_unmute() {
 
 void cdrom_t::logic_transition(stage_t stage, int timer) {
   logic.stage = stage;
-  logic.timer = timer;
+
+  scheduler->schedule(logic.event, timer);
 }
 
 void cdrom_t::logic_idling() {
@@ -341,6 +401,7 @@ void cdrom_t::logic_transferring_response() {
 void cdrom_t::logic_deliver_interrupt() {
   if (interrupt_request == 0) {
     interrupt_request = logic.interrupt_request;
+    update_irq();
 
     logic_transition(&cdrom_t::logic_idling, 1);
   } else {
@@ -354,7 +415,8 @@ void cdrom_t::logic_deliver_interrupt() {
 
 void cdrom_t::drive_transition(stage_t stage, int timer) {
   drive.stage = stage;
-  drive.timer = timer;
+
+  scheduler->schedule(drive.event, timer);
 }
 
 void cdrom_t::drive_idling() {
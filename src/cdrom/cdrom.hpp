@@ -8,6 +8,8 @@
 #include "fifo.hpp"
 #include "interrupt-access.hpp"
 #include "memory-component.hpp"
+#include "scheduler.hpp"
+#include "state.hpp"
 
 
 struct cdrom_sector_timecode_t {
@@ -21,9 +23,12 @@ class cdrom_t : public memory_component_t {
 
   interrupt_access_t *irq;
 
+  scheduler_t *scheduler;
+
   int32_t index;
   int32_t interrupt_enable;
   int32_t interrupt_request;
+  bool interrupt_line;
 
   cdrom_sector_timecode_t seek_timecode;
   cdrom_sector_timecode_t read_timecode;
@@ -47,7 +52,7 @@ class cdrom_t : public memory_component_t {
 
   struct {
     stage_t stage;
-    int32_t timer;
+    int event;
 
     int32_t interrupt_request;
 
@@ -58,7 +63,7 @@ class cdrom_t : public memory_component_t {
 
   struct {
     stage_t stage;
-    int32_t timer;
+    int event;
   } drive;
 
   struct {
@@ -68,7 +73,9 @@ class cdrom_t : public memory_component_t {
 
 public:
 
-  cdrom_t(interrupt_access_t *irq, const char *game_file_name);
+  cdrom_t(interrupt_access_t *irq, scheduler_t *scheduler, const char *game_file_name);
+
+  void serialize(state_t &state);
 
   uint32_t io_read_byte(uint32_t address);
 
@@ -110,7 +117,9 @@ public:
 
   void io_write_port_3_3(uint8_t data);
 
-  void tick();
+  void serialize_stage(state_t &state, stage_t &stage);
+
+  void update_irq();
 
   void do_seek();
 
@@ -11,31 +11,94 @@
 #include "expansion/exp2.hpp"
 #include "expansion/exp3.hpp"
 #include "gpu/gpu.hpp"
+#include "gpu/gpu-recorder.hpp"
+#include "gpu/gpu-stats.hpp"
 #include "input/input.hpp"
 #include "mdec/mdec.hpp"
 #include "spu/spu.hpp"
-#include "limits.hpp"
 #include "utility.hpp"
 
 
-console_t::console_t(const char *bios_file_name, const char *game_file_name)
+static const int ITERATIONS = 2;
+
+static const int CPU_FREQ = 33868800;
+static const int CYCLES_PER_FRAME = CPU_FREQ / 60 / ITERATIONS;
+
+// where the BIOS jumps into the shell, once the kernel is set up
+
+static const uint32_t SHELL_ENTRY = 0x80030000;
+
+// bumped whenever the layout of a serialized component changes
+
+static const uint32_t BOOT_STATE_MAGIC = 0x54425850; // "PXBT"
+static const uint32_t BOOT_STATE_VERSION = 2;
+
+
+console_t::console_t(const char *bios_file_name, const char *game_file_name, const char *exe_file_name)
   : bios("bios")
   , dmem("dmem")
-  , wram("wram") {
+  , wram("wram")
+  , gpu_stats_interval(0)
+  , exe_file_name(exe_file_name)
+  , bios_hash(0) {
 
-  cdrom = new cdrom_t(this, game_file_name);
-  counter = new counter_t(this);
+  cdrom = new cdrom_t(this, &scheduler, game_file_name);
+  counter = new counter_t(this, &scheduler);
   cpu = new cpu_t(this);
-  dma = new dma_t(this, this);
+  gpu = new gpu_t();
+  dma = new dma_t(this, this, gpu);
   exp1 = new exp1_t();
   exp2 = new exp2_t();
   exp3 = new exp3_t();
-  gpu = new gpu_t();
-  input = new input_t(this);
+  input = new input_t(this, &scheduler);
   mdec = new mdec_t();
   spu = new spu_t();
 
-  bios.load_blob(bios_file_name);
+  vblank_event = scheduler.add([this]() {
+    send(interrupt_type_t::VBLANK);
+
+    frame_done = true;
+    scheduler.schedule(vblank_event, CYCLES_PER_FRAME * ITERATIONS);
+  });
+
+  scheduler.schedule(vblank_event, CYCLES_PER_FRAME * ITERATIONS);
+
+  map_pages(read_pages, 0x00000000, 0x007fffff, wram.b, mib(2));
+  map_pages(read_pages, 0x1fc00000, 0x1fc7ffff, bios.b, kib(512));
+  map_pages(read_pages, 0x1f800000, 0x1f800fff, dmem.b, kib(4));
+
+  map_pages(write_pages, 0x00000000, 0x007fffff, wram.b, mib(2));
+  map_pages(write_pages, 0x1f800000, 0x1f800fff, dmem.b, kib(4));
+
+  components = new memory_component_t *[page_count];
+
+  memset(components, 0, sizeof(memory_component_t *) * page_count);
+  memset(io_components, 0, sizeof(io_components));
+
+  map_components(0x00000000, 0x007fffff, &wram);
+  map_components(0x1fc00000, 0x1fc7ffff, &bios);
+  map_components(0x1f800000, 0x1f800fff, &dmem);
+  map_components(0x1f801040, 0x1f80104f, input);
+  map_components(0x1f801070, 0x1f801077, cpu);
+  map_components(0x1f801080, 0x1f8010ff, dma);
+  map_components(0x1f801100, 0x1f80113f, counter);
+  map_components(0x1f801800, 0x1f801803, cdrom);
+  map_components(0x1f801810, 0x1f801817, gpu);
+  map_components(0x1f801820, 0x1f801827, mdec);
+  map_components(0x1f801c00, 0x1f801fff, spu);
+  map_components(0x1f000000, 0x1f7fffff, exp1);
+  map_components(0x1f802000, 0x1f802fff, exp2);
+  map_components(0x1fa00000, 0x1fbfffff, exp3);
+
+  // without a BIOS image the kernel is emulated
+
+  if (bios_file_name != nullptr) {
+    bios.load_blob(bios_file_name);
+  }
+  else {
+    cpu->enable_hle(game_file_name, exe_file_name);
+    this->exe_file_name = nullptr;
+  }
 }
 
 
@@ -45,28 +108,180 @@ void console_t::send(interrupt_type_t flag) {
 }
 
 
-memory_component_t *console_t::decode(uint32_t address) {
-#define between(min, max) \
-  limits::between<(min), (max)>(address)
+void console_t::set_cpu_mode(cpu_mode_t mode) {
+  cpu->set_mode(mode);
+}
+
+
+void console_t::enable_gpu_thread() {
+  gpu->enable_thread();
+}
+
+
+void console_t::enable_gpu_tiles() {
+  gpu->enable_tiles();
+}
+
+
+void console_t::enable_gpu_stats(int interval) {
+  gpu->enable_stats();
+  gpu_stats_interval = interval;
+}
+
+
+void console_t::report_gpu_stats() {
+  if (gpu->stats != nullptr && gpu->stats->frames != 0) {
+    gpu->stats->print();
+  }
+}
+
+
+bool console_t::start_gpu_recording(const char *file_name) {
+  return gpu->start_recording(file_name);
+}
+
+
+void console_t::stop_gpu_recording() {
+  gpu->stop_recording();
+}
+
+
+void console_t::enable_boot_cache(const char *directory) {
+  // the state at the shell entry point only depends on the BIOS, so it is
+  // cached per BIOS image.
+
+  bios_hash = 0xcbf29ce484222325;
+
+  for (uint32_t i = 0; i < kib(512); i++) {
+    bios_hash = (bios_hash ^ bios.b[i]) * 0x100000001b3;
+  }
+
+  char file_name[32];
+  snprintf(file_name, sizeof(file_name), "boot-%016llx.state", (unsigned long long)bios_hash);
+
+  boot_cache_file_name = std::string(directory) + "/" + file_name;
+
+  state_t state;
+
+  if (state.load(boot_cache_file_name.c_str()) && serialize_boot_state(state)) {
+    printf("[console] restored boot state from '%s'\n", boot_cache_file_name.c_str());
+    boot_cache_file_name.clear();
+  }
+}
+
+
+void console_t::serialize(state_t &state) {
+  wram.serialize(state);
+  dmem.serialize(state);
+  scheduler.serialize(state);
+  cdrom->serialize(state);
+  counter->serialize(state);
+  cpu->serialize(state);
+  dma->serialize(state);
+  gpu->serialize(state);
+  input->serialize(state);
+  spu->serialize(state);
+}
+
+
+bool console_t::serialize_boot_state(state_t &state) {
+  uint32_t magic = BOOT_STATE_MAGIC;
+  uint32_t version = BOOT_STATE_VERSION;
+  uint64_t hash = bios_hash;
+
+  state.io(magic);
+  state.io(version);
+  state.io(hash);
+
+  if (state.is_loading() == false) {
+    serialize(state);
+    return true;
+  }
 
-  if (between(0x00000000, 0x007fffff)) { return &wram; }
-  if (between(0x1fc00000, 0x1fc7ffff)) { return &bios; }
-  if (between(0x1f800000, 0x1f8003ff)) { return &dmem; }
-  if (between(0x1f801040, 0x1f80104f)) { return input; }
-  if (between(0x1f801070, 0x1f801077)) { return cpu; }
-  if (between(0x1f801080, 0x1f8010ff)) { return dma; }
-  if (between(0x1f801100, 0x1f80113f)) { return counter; }
-  if (between(0x1f801800, 0x1f801803)) { return cdrom; }
-  if (between(0x1f801810, 0x1f801817)) { return gpu; }
-  if (between(0x1f801820, 0x1f801827)) { return mdec; }
-  if (between(0x1f801c00, 0x1f801fff)) { return spu; }
-  if (between(0x1f000000, 0x1f7fffff)) { return exp1; }
-  if (between(0x1f802000, 0x1f802fff)) { return exp2; }
-  if (between(0x1fa00000, 0x1fbfffff)) { return exp3; }
+  // only restore a snapshot that matches this build and this BIOS exactly,
+  // a partial restore would leave the machine in a mess.
 
-#undef between
+  state_t current;
+  current.io(magic);
+  current.io(version);
+  current.io(hash);
+  serialize(current);
 
-  return nullptr;
+  if (magic != BOOT_STATE_MAGIC ||
+      version != BOOT_STATE_VERSION ||
+      hash != bios_hash ||
+      state.get_size() != current.get_size()) {
+    return false;
+  }
+
+  serialize(state);
+
+  return state.is_valid();
+}
+
+
+void console_t::enter_shell() {
+  if (boot_cache_file_name.size()) {
+    state_t state;
+    serialize_boot_state(state);
+
+    if (state.save(boot_cache_file_name.c_str()) == false) {
+      printf("[console] unable to save boot state to '%s'\n", boot_cache_file_name.c_str());
+    }
+
+    boot_cache_file_name.clear();
+  }
+
+  if (exe_file_name != nullptr) {
+    cpu->load_exe(exe_file_name);
+    exe_file_name = nullptr;
+  }
+}
+
+
+void console_t::protect_code(uint32_t address) {
+  for (uint32_t mirror = 0; mirror < 0x00800000; mirror += mib(2)) {
+    write_pages[(mirror | (address & (mib(2) - 1))) >> page_shift] = nullptr;
+  }
+}
+
+
+void console_t::unprotect_code(uint32_t address) {
+  uint8_t *page = &wram.b[address & (mib(2) - 1) & ~page_mask];
+
+  for (uint32_t mirror = 0; mirror < 0x00800000; mirror += mib(2)) {
+    write_pages[(mirror | (address & (mib(2) - 1))) >> page_shift] = page;
+  }
+}
+
+
+void console_t::map_components(uint32_t min, uint32_t max, memory_component_t *component) {
+  // the i/o page is shared by most of the hardware, so it gets a table of
+  // its own with one entry per register.
+
+  if ((min >> page_shift) == 0x1f801) {
+    for (uint32_t address = min; address <= max; address += 4) {
+      io_components[(address & page_mask) / 4] = component;
+    }
+  }
+  else {
+    for (uint32_t address = min; address <= max; address += page_size) {
+      components[address >> page_shift] = component;
+    }
+  }
+}
+
+
+memory_component_t *console_t::decode(uint32_t address) {
+  if (address >= 0x20000000) {
+    return nullptr;
+  }
+
+  if ((address >> page_shift) == 0x1f801) {
+    return io_components[(address & page_mask) / 4];
+  }
+
+  return components[address >> page_shift];
 }
 
 
@@ -85,16 +300,12 @@ uint32_t console_t::read_memory_control(int size, uint32_t address) {
     case 0x1f801060: return 0x00000b88;
   }
 
-  if (address == 0xfffe0130) {
-    return 0;
-  }
-
   printf("system.read(%d, 0x%08x)\n", size, address);
   throw std::exception();
 }
 
 
-uint32_t console_t::read_byte(uint32_t address) {
+uint32_t console_t::slow_read_byte(uint32_t address) {
   auto component = decode(address);
 
   return component != nullptr
@@ -104,7 +315,7 @@ uint32_t console_t::read_byte(uint32_t address) {
 }
 
 
-uint32_t console_t::read_half(uint32_t address) {
+uint32_t console_t::slow_read_half(uint32_t address) {
   auto component = decode(address);
 
   return component != nullptr
@@ -114,7 +325,7 @@ uint32_t console_t::read_half(uint32_t address) {
 }
 
 
-uint32_t console_t::read_word(uint32_t address) {
+uint32_t console_t::slow_read_word(uint32_t address) {
   auto component = decode(address);
 
   return component != nullptr
@@ -139,38 +350,18 @@ void console_t::write_memory_control(int size, uint32_t address, uint32_t data)
     case 0x1f801060: assert(data == 0x00000b88); return;
   }
 
-  if (address == 0xfffe0130) {
-    // system.write(2, 0xfffe0130, 0x00000804)
-    // system.write(2, 0xfffe0130, 0x00000800)
-    // system.write(2, 0xfffe0130, 0x0001e988)
-
-    //     17 :: nostr  - No Streaming
-    //     16 :: ldsch  - Enable Load Scheduling
-    //     15 :: bgnt   - Enable Bus Grant
-    //     14 :: nopad  - No Wait State
-    //     13 :: rdpri  - Enable Read Priority
-    //     12 :: intp   - Interrupt Polarity
-    //     11 :: is1    - Enable I-Cache Set 1
-    //     10 :: is0    - Enable I-Cache Set 0
-    //  9,  8 :: iblksz - I-Cache Refill Size
-    //      7 :: ds     - Enable D-Cache
-    //  5,  4 :: dblksz - D-Cache Refill Size
-    //      3 :: ram    - Scratchpad RAM
-    //      2 :: tag    - Tag Test Mode
-    //      1 :: inv    - Invalidate Mode
-    //      0 :: lock   - Lock Mode
-
-    return;
-  }
-
   printf("system.write(%d, 0x%08x, 0x%08x)\n", size, address, data);
   throw std::exception();
 }
 
 
-void console_t::write_byte(uint32_t address, uint32_t data) {
+void console_t::slow_write_byte(uint32_t address, uint32_t data) {
   auto component = decode(address);
 
+  if (component == &wram) {
+    cpu->invalidate_code(address);
+  }
+
   return (component != nullptr)
     ? component->io_write_byte(address, data)
     : write_memory_control(1, address, data)
@@ -178,9 +369,13 @@ void console_t::write_byte(uint32_t address, uint32_t data) {
 }
 
 
-void console_t::write_half(uint32_t address, uint32_t data) {
+void console_t::slow_write_half(uint32_t address, uint32_t data) {
   auto component = decode(address);
 
+  if (component == &wram) {
+    cpu->invalidate_code(address);
+  }
+
   return (component != nullptr)
     ? component->io_write_half(address, data)
     : write_memory_control(2, address, data)
@@ -188,9 +383,13 @@ void console_t::write_half(uint32_t address, uint32_t data) {
 }
 
 
-void console_t::write_word(uint32_t address, uint32_t data) {
+void console_t::slow_write_word(uint32_t address, uint32_t data) {
   auto component = decode(address);
 
+  if (component == &wram) {
+    cpu->invalidate_code(address);
+  }
+
   return (component != nullptr)
     ? component->io_write_word(address, data)
     : write_memory_control(4, address, data)
@@ -199,22 +398,45 @@ void console_t::write_word(uint32_t address, uint32_t data) {
 
 
 void console_t::run_for_one_frame(uint16_t **vram, int *w, int *h) {
-  const int ITERATIONS = 2;
+  frame_done = false;
+
+  // the scheduler only does work when the cpu crosses a deadline, so this is
+  // one compare per block.
+
+  while (frame_done == false) {
+    if ((exe_file_name != nullptr || boot_cache_file_name.size()) && cpu->get_pc() == SHELL_ENTRY) {
+      enter_shell();
+    }
+
+    int64_t deadline = scheduler.get_next_deadline();
 
-  const int CPU_FREQ = 33868800;
-  const int CYCLES_PER_FRAME = CPU_FREQ / 60 / ITERATIONS;
+    int count = cpu->tick();
+    scheduler.tick(count * ITERATIONS);
 
-  for (int i = 0; i < CYCLES_PER_FRAME; i++) {
-    cpu->tick();
+    // an idle loop can't get anywhere before the next event, unless one
+    // already fired while it ran.
 
-    for (int j = 0; j < ITERATIONS; j++) {
-      counter->tick();
-      cdrom->tick();
-      input->tick();
+    if (cpu->is_idle() && scheduler.get_time() < deadline) {
+      scheduler.tick(deadline - scheduler.get_time());
     }
   }
 
-  send(interrupt_type_t::VBLANK);
+  // the render thread has to be done with the frame before it's shown
+
+  gpu->sync();
+
+  if (gpu->recorder != nullptr) {
+    gpu->recorder->end_frame();
+  }
+
+  if (gpu->stats != nullptr) {
+    gpu->stats->frames++;
+
+    if (gpu_stats_interval != 0 && int(gpu->stats->frames) == gpu_stats_interval) {
+      gpu->stats->print();
+      gpu->stats->reset();
+    }
+  }
 
   static const int w_lut[8] = { 256, 368, 320, 368, 512, 368, 640, 368 };
   static const int h_lut[2] = { 240, 480 };
@@ -2,9 +2,12 @@
 #define __psxact_console__
 
 #include <cstdint>
+#include <string>
 #include "interrupt-access.hpp"
 #include "memory.hpp"
 #include "memory-access.hpp"
+#include "scheduler.hpp"
+#include "state.hpp"
 
 class cdrom_t;
 
@@ -12,6 +15,8 @@ class counter_t;
 
 class cpu_t;
 
+enum class cpu_mode_t;
+
 class dma_t;
 
 class exp1_t;
@@ -34,7 +39,7 @@ class console_t
 
   memory_t< kib(512) > bios;
   memory_t< mib(  2) > wram;
-  memory_t< kib(  1) > dmem;
+  memory_t< kib(  4) > dmem;
 
   cdrom_t *cdrom;
   counter_t *counter;
@@ -48,30 +53,74 @@ class console_t
   mdec_t *mdec;
   spu_t *spu;
 
+  scheduler_t scheduler;
+  int vblank_event;
+  bool frame_done;
+
+  int gpu_stats_interval;
+
+  const char *exe_file_name;
+
+  std::string boot_cache_file_name;
+  uint64_t bios_hash;
+
+  memory_component_t **components;
+  memory_component_t *io_components[kib(4) / 4];
+
 public:
 
-  console_t(const char *bios_file_name, const char *game_file_name);
+  console_t(const char *bios_file_name, const char *game_file_name, const char *exe_file_name);
 
   void send(interrupt_type_t flag);
 
-  uint32_t read_byte(uint32_t address);
+  void set_cpu_mode(cpu_mode_t mode);
+
+  void enable_gpu_thread();
+
+  void enable_gpu_tiles();
+
+  // counts GPU work, printing it every 'interval' frames if that isn't 0
+
+  void enable_gpu_stats(int interval);
+
+  void report_gpu_stats();
 
-  uint32_t read_half(uint32_t address);
+  bool start_gpu_recording(const char *file_name);
 
-  uint32_t read_word(uint32_t address);
+  void stop_gpu_recording();
 
-  void write_byte(uint32_t address, uint32_t data);
+  void enable_boot_cache(const char *directory);
 
-  void write_half(uint32_t address, uint32_t data);
+  void serialize(state_t &state);
 
-  void write_word(uint32_t address, uint32_t data);
+  void protect_code(uint32_t address);
+
+  void unprotect_code(uint32_t address);
 
   void run_for_one_frame(uint16_t **vram, int *w, int *h);
 
 private:
 
+  void enter_shell();
+
+  bool serialize_boot_state(state_t &state);
+
+  void map_components(uint32_t min, uint32_t max, memory_component_t *component);
+
   memory_component_t *decode(uint32_t address);
 
+  uint32_t slow_read_byte(uint32_t address);
+
+  uint32_t slow_read_half(uint32_t address);
+
+  uint32_t slow_read_word(uint32_t address);
+
+  void slow_write_byte(uint32_t address, uint32_t data);
+
+  void slow_write_half(uint32_t address, uint32_t data);
+
+  void slow_write_word(uint32_t address, uint32_t data);
+
   uint32_t read_memory_control(int size, uint32_t address);
 
   void write_memory_control(int size, uint32_t address, uint32_t data);
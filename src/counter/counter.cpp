@@ -12,12 +12,22 @@
 
 #include "counter/counter.hpp"
 
+#include <algorithm>
+#include <limits>
 #include "utility.hpp"
 
 
-counter_t::counter_t(interrupt_access_t *irq)
+counter_t::counter_t(interrupt_access_t *irq, scheduler_t *scheduler)
   : memory_component_t("counter")
-  , irq(irq) {
+  , irq(irq)
+  , scheduler(scheduler) {
+
+  event = scheduler->add([this]() {
+    sync();
+    schedule_irq();
+  });
+
+  last_sync = scheduler->get_time();
 
   unit_init(0, 11, 7 * 4);
   unit_init(1, 11, 7 * 3413);
@@ -25,7 +35,17 @@ counter_t::counter_t(interrupt_access_t *irq)
 }
 
 
+void counter_t::serialize(state_t &state) {
+  state.io(last_sync);
+  state.io(in_hblank);
+  state.io(in_vblank);
+  state.io(units);
+}
+
+
 uint32_t counter_t::io_read_half(uint32_t address) {
+  sync();
+
   switch (address & ~3) {
     case 0x1f801100: return unit_get_counter(0);
     case 0x1f801104: return unit_get_control(0);
@@ -58,20 +78,22 @@ uint32_t counter_t::io_read_word(uint32_t address) {
 
 
 void counter_t::io_write_half(uint32_t address, uint32_t data) {
+  sync();
+
   switch (address & ~3) {
-    case 0x1f801100: return unit_set_counter(0, data);
-    case 0x1f801104: return unit_set_control(0, data);
-    case 0x1f801108: return unit_set_compare(0, data);
+    case 0x1f801100: unit_set_counter(0, data); break;
+    case 0x1f801104: unit_set_control(0, data); break;
+    case 0x1f801108: unit_set_compare(0, data); break;
     case 0x1f80110c: return;
 
-    case 0x1f801110: return unit_set_counter(1, data);
-    case 0x1f801114: return unit_set_control(1, data);
-    case 0x1f801118: return unit_set_compare(1, data);
+    case 0x1f801110: unit_set_counter(1, data); break;
+    case 0x1f801114: unit_set_control(1, data); break;
+    case 0x1f801118: unit_set_compare(1, data); break;
     case 0x1f80111c: return;
 
-    case 0x1f801120: return unit_set_counter(2, data);
-    case 0x1f801124: return unit_set_control(2, data);
-    case 0x1f801128: return unit_set_compare(2, data);
+    case 0x1f801120: unit_set_counter(2, data); break;
+    case 0x1f801124: unit_set_control(2, data); break;
+    case 0x1f801128: unit_set_compare(2, data); break;
     case 0x1f80112c: return;
 
     case 0x1f801130: return;
@@ -79,6 +101,8 @@ void counter_t::io_write_half(uint32_t address, uint32_t data) {
     case 0x1f801138: return;
     case 0x1f80113c: return;
   }
+
+  schedule_irq();
 }
 
 
@@ -204,11 +228,19 @@ void counter_t::unit_irq(int n) {
 }
 
 
-void counter_t::unit_tick(int n) {
+void counter_t::unit_advance(int n, int64_t increments) {
   auto &timer = units[n];
 
-  if (timer.running) {
-    timer.counter++;
+  // jump straight to the next increment that matters, either the counter
+  // wrapping around or reaching the compare value.
+
+  while (increments > 0) {
+    int64_t to_compare = ((timer.compare.value - timer.counter - 1) & 0xffff) + 1;
+    int64_t to_maximum = 0x10000 - timer.counter;
+    int64_t step = std::min(increments, std::min(to_compare, to_maximum));
+
+    timer.counter = uint16_t(timer.counter + step);
+    increments -= step;
 
     if (timer.counter == 0) {
       timer.maximum.reached = 1;
@@ -227,49 +259,132 @@ void counter_t::unit_tick(int n) {
 
       if (timer.compare.reset_counter) {
         timer.counter = 0;
+
+        // with nothing left to interrupt, the counter just goes around
+        // between zero and the compare value.
+
+        bool irq_possible = timer.irq.enable && (timer.compare.irq_enable || timer.maximum.irq_enable);
+
+        if (timer.compare.value != 0 && irq_possible == false) {
+          increments %= timer.compare.value;
+        }
       }
     }
   }
 }
 
 
-void counter_t::unit_prescale(int n) {
+int64_t counter_t::unit_prescale(int n, int64_t elapsed) {
   auto &prescaler = units[n].prescaler;
 
   if (prescaler.enable == 0) {
-    unit_tick(n);
+    return elapsed;
   }
-  else {
-    prescaler.cycles -= prescaler.single;
 
-    while (prescaler.cycles <= 0) {
-      prescaler.cycles += prescaler.period;
-      unit_tick(n);
+  // every tick takes `single' from the prescaler, and every time it drops to
+  // zero or below the counter increments and `period' is added back.
+
+  int64_t cycles = prescaler.cycles - (elapsed * prescaler.single);
+  int64_t increments = 0;
+
+  if (cycles <= 0) {
+    increments = (-cycles / prescaler.period) + 1;
+    cycles += increments * prescaler.period;
+  }
+
+  prescaler.cycles = int(cycles);
+
+  return increments;
+}
+
+
+void counter_t::sync() {
+  int64_t now = scheduler->get_time();
+  int64_t elapsed = now - last_sync;
+
+  last_sync = now;
+
+  for (int n = 0; n < 3; n++) {
+    int64_t increments = unit_prescale(n, elapsed);
+
+    if (units[n].running) {
+      unit_advance(n, increments);
     }
   }
 }
 
 
-void counter_t::tick() {
-  unit_prescale(0);
-  unit_prescale(1);
-  unit_prescale(2);
+int64_t counter_t::unit_get_irq_delay(int n) {
+  auto &unit = units[n];
+
+  if (unit.running == 0 || unit.irq.enable == 0) {
+    return std::numeric_limits<int64_t>::max();
+  }
+
+  // counter increments until the unit can raise an interrupt. waking up too
+  // early is harmless, the handler just schedules the next one.
+
+  int64_t increments = std::numeric_limits<int64_t>::max();
+
+  if (unit.compare.irq_enable) {
+    increments = ((unit.compare.value - unit.counter - 1) & 0xffff) + 1;
+  }
+
+  if (unit.maximum.irq_enable) {
+    increments = std::min<int64_t>(increments, 0x10000 - unit.counter);
+  }
+
+  if (increments == std::numeric_limits<int64_t>::max()) {
+    return increments;
+  }
+
+  auto &prescaler = unit.prescaler;
+
+  if (prescaler.enable == 0) {
+    return increments;
+  }
+
+  int64_t cycles = prescaler.cycles + (increments - 1) * prescaler.period;
+
+  return (cycles + prescaler.single - 1) / prescaler.single;
+}
+
+
+void counter_t::schedule_irq() {
+  int64_t delay = std::min(
+    std::min(unit_get_irq_delay(0), unit_get_irq_delay(1)),
+    unit_get_irq_delay(2));
+
+  if (delay == std::numeric_limits<int64_t>::max()) {
+    scheduler->cancel(event);
+  }
+  else {
+    scheduler->schedule(event, delay);
+  }
 }
 
 
 void counter_t::hblank(bool active) {
+  sync();
+
   in_hblank = active;
 
   auto &unit = units[0];
 
   unit.running = is_running(unit.synch_mode, in_hblank);
+
+  schedule_irq();
 }
 
 
 void counter_t::vblank(bool active) {
+  sync();
+
   in_vblank = active;
 
   auto &unit = units[1];
 
   unit.running = is_running(unit.synch_mode, in_vblank);
+
+  schedule_irq();
 }
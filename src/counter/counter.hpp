@@ -5,6 +5,8 @@
 #include "console.hpp"
 #include "interrupt-access.hpp"
 #include "memory-component.hpp"
+#include "scheduler.hpp"
+#include "state.hpp"
 
 
 struct counter_unit_t {
@@ -52,6 +54,10 @@ class counter_t : public memory_component_t {
 
   interrupt_access_t *irq;
 
+  scheduler_t *scheduler;
+  int event;
+  int64_t last_sync;
+
   bool in_hblank;
   bool in_vblank;
 
@@ -59,7 +65,7 @@ class counter_t : public memory_component_t {
 
 public:
 
-  counter_t(interrupt_access_t *irq);
+  counter_t(interrupt_access_t *irq, scheduler_t *scheduler);
 
   uint32_t io_read_half(uint32_t address);
 
@@ -69,7 +75,7 @@ public:
 
   void io_write_word(uint32_t address, uint32_t data);
 
-  void tick();
+  void serialize(state_t &state);
 
   void hblank(bool active);
 
@@ -77,13 +83,19 @@ public:
 
 private:
 
+  void sync();
+
+  void schedule_irq();
+
+  int64_t unit_get_irq_delay(int n);
+
   void unit_init(int n, int single, int period);
 
   void unit_irq(int n);
 
-  void unit_tick(int n);
+  void unit_advance(int n, int64_t increments);
 
-  void unit_prescale(int n);
+  int64_t unit_prescale(int n, int64_t elapsed);
 
   uint16_t unit_get_compare(int n);
 
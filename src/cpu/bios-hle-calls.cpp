@@ -0,0 +1,806 @@
+#include "cpu/bios-hle.hpp"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include "cpu/cpu.hpp"
+
+
+void bios_hle_t::call_a0(uint32_t function) {
+  uint32_t a0 = get_arg(0);
+  uint32_t a1 = get_arg(1);
+  uint32_t a2 = get_arg(2);
+
+  switch (function) {
+    case 0x00: // FileOpen
+      return ret(file_open(read_string(a0)));
+
+    case 0x01: // FileSeek
+      if (a0 >= 16 || files[a0].open == false) {
+        return ret(0xffffffff);
+      }
+
+      files[a0].position = (a2 == 0) ? a1 : files[a0].position + a1;
+      return ret(files[a0].position);
+
+    case 0x02: // FileRead
+      return ret(file_read(a0, a1, a2));
+
+    case 0x03: // FileWrite
+      if (a0 != 1) {
+        return ret(0xffffffff);
+      }
+
+      for (uint32_t i = 0; i < a2; i++) {
+        putchar(read_byte(a1 + i));
+      }
+
+      return ret(a2);
+
+    case 0x04: // FileClose
+      if (a0 < 16) {
+        files[a0].open = false;
+      }
+
+      return ret(a0);
+
+    case 0x0c: // strtoul
+    case 0x0d: { // strtol
+      std::string s = read_string(a0);
+      char *end;
+
+      uint32_t value = (function == 0x0c)
+        ? uint32_t(strtoul(s.c_str(), &end, int(a2)))
+        : uint32_t(strtol(s.c_str(), &end, int(a2)))
+        ;
+
+      if (a1 != 0) {
+        write_word(a1, a0 + uint32_t(end - s.c_str()));
+      }
+
+      return ret(value);
+    }
+
+    case 0x0e: // abs
+    case 0x0f: // labs
+      return ret(int32_t(a0) < 0 ? -a0 : a0);
+
+    case 0x10: // atoi
+    case 0x11: // atol
+      return ret(uint32_t(atoi(read_string(a0).c_str())));
+
+    case 0x13: // setjmp
+      write_word(a0 + 0x00, cpu->regs.gp[31]);
+      write_word(a0 + 0x04, cpu->regs.gp[29]);
+      write_word(a0 + 0x08, cpu->regs.gp[30]);
+
+      for (int i = 0; i < 8; i++) {
+        write_word(a0 + 0x0c + (i * 4), cpu->regs.gp[16 + i]);
+      }
+
+      write_word(a0 + 0x2c, cpu->regs.gp[28]);
+      return ret(0);
+
+    case 0x14: // longjmp
+      cpu->regs.gp[31] = read_word(a0 + 0x00);
+      cpu->regs.gp[29] = read_word(a0 + 0x04);
+      cpu->regs.gp[30] = read_word(a0 + 0x08);
+
+      for (int i = 0; i < 8; i++) {
+        cpu->regs.gp[16 + i] = read_word(a0 + 0x0c + (i * 4));
+      }
+
+      cpu->regs.gp[28] = read_word(a0 + 0x2c);
+      return ret(a1);
+
+    case 0x15: { // strcat
+      uint32_t dst = a0;
+
+      while (read_byte(dst)) {
+        dst++;
+      }
+
+      while (uint32_t c = read_byte(a1++)) {
+        write_byte(dst++, c);
+      }
+
+      write_byte(dst, 0);
+      return ret(a0);
+    }
+
+    case 0x16: { // strncat
+      uint32_t dst = a0;
+
+      while (read_byte(dst)) {
+        dst++;
+      }
+
+      for (uint32_t i = 0; i < a2; i++) {
+        uint32_t c = read_byte(a1 + i);
+        if (c == 0) {
+          break;
+        }
+
+        write_byte(dst++, c);
+      }
+
+      write_byte(dst, 0);
+      return ret(a0);
+    }
+
+    case 0x17: // strcmp
+    case 0x18: { // strncmp
+      uint32_t limit = (function == 0x17) ? 0xffffffff : a2;
+
+      for (uint32_t i = 0; i < limit; i++) {
+        uint32_t c0 = read_byte(a0 + i);
+        uint32_t c1 = read_byte(a1 + i);
+
+        if (c0 != c1 || c0 == 0) {
+          return ret(c0 - c1);
+        }
+      }
+
+      return ret(0);
+    }
+
+    case 0x19: { // strcpy
+      uint32_t i = 0;
+
+      for (uint32_t c = 1; c != 0; i++) {
+        c = read_byte(a1 + i);
+        write_byte(a0 + i, c);
+      }
+
+      return ret(a0);
+    }
+
+    case 0x1a: { // strncpy
+      bool end = false;
+
+      for (uint32_t i = 0; i < a2; i++) {
+        uint32_t c = end ? 0 : read_byte(a1 + i);
+        end = (c == 0);
+
+        write_byte(a0 + i, c);
+      }
+
+      return ret(a0);
+    }
+
+    case 0x1b: // strlen
+      return ret(uint32_t(read_string(a0).size()));
+
+    case 0x1c: // index
+    case 0x1e: { // strchr
+      for (;; a0++) {
+        uint32_t c = read_byte(a0);
+
+        if (c == (a1 & 0xff)) {
+          return ret(a0);
+        }
+
+        if (c == 0) {
+          return ret(0);
+        }
+      }
+    }
+
+    case 0x1d: // rindex
+    case 0x1f: { // strrchr
+      uint32_t found = 0;
+
+      for (;; a0++) {
+        uint32_t c = read_byte(a0);
+
+        if (c == (a1 & 0xff)) {
+          found = a0;
+        }
+
+        if (c == 0) {
+          return ret(found);
+        }
+      }
+    }
+
+    case 0x20: // strpbrk
+    case 0x21: // strspn
+    case 0x22: { // strcspn
+      std::string set = read_string(a1);
+      uint32_t i = 0;
+
+      for (;; i++) {
+        uint32_t c = read_byte(a0 + i);
+        bool in_set = c != 0 && set.find(char(c)) != std::string::npos;
+
+        if (c == 0 || in_set != (function == 0x21)) {
+          break;
+        }
+      }
+
+      if (function == 0x20) {
+        return ret(read_byte(a0 + i) ? a0 + i : 0);
+      }
+
+      return ret(i);
+    }
+
+    case 0x24: { // strstr
+      std::string s = read_string(a0);
+      size_t found = s.find(read_string(a1));
+
+      return ret(found == std::string::npos ? 0 : a0 + uint32_t(found));
+    }
+
+    case 0x25: // toupper
+      return ret(uint32_t(toupper(int(a0 & 0xff))));
+
+    case 0x26: // tolower
+      return ret(uint32_t(tolower(int(a0 & 0xff))));
+
+    case 0x27: // bcopy
+      for (uint32_t i = 0; i < a2; i++) {
+        write_byte(a1 + i, read_byte(a0 + i));
+      }
+
+      return ret(a1);
+
+    case 0x28: // bzero
+      for (uint32_t i = 0; i < a1; i++) {
+        write_byte(a0 + i, 0);
+      }
+
+      return ret(a0);
+
+    case 0x29: // bcmp
+    case 0x2d: // memcmp
+      for (uint32_t i = 0; i < a2; i++) {
+        uint32_t c0 = read_byte(a0 + i);
+        uint32_t c1 = read_byte(a1 + i);
+
+        if (c0 != c1) {
+          return ret(c0 - c1);
+        }
+      }
+
+      return ret(0);
+
+    case 0x2a: // memcpy
+      for (uint32_t i = 0; i < a2; i++) {
+        write_byte(a0 + i, read_byte(a1 + i));
+      }
+
+      return ret(a0);
+
+    case 0x2b: // memset
+      for (uint32_t i = 0; i < a2; i++) {
+        write_byte(a0 + i, a1);
+      }
+
+      return ret(a0);
+
+    case 0x2c: // memmove
+      if (a0 > a1) {
+        for (uint32_t i = a2; i != 0; i--) {
+          write_byte(a0 + i - 1, read_byte(a1 + i - 1));
+        }
+      }
+      else {
+        for (uint32_t i = 0; i < a2; i++) {
+          write_byte(a0 + i, read_byte(a1 + i));
+        }
+      }
+
+      return ret(a0);
+
+    case 0x2e: // memchr
+      for (uint32_t i = 0; i < a2; i++) {
+        if (read_byte(a0 + i) == (a1 & 0xff)) {
+          return ret(a0 + i);
+        }
+      }
+
+      return ret(0);
+
+    case 0x2f: // rand
+      rand_seed = (rand_seed * 0x41c64e6d) + 0x3039;
+      return ret((rand_seed >> 16) & 0x7fff);
+
+    case 0x30: // srand
+      rand_seed = a0;
+      return ret(0);
+
+    case 0x33: // malloc
+      return ret(malloc(a0));
+
+    case 0x34: // free
+      free(a0);
+      return ret(0);
+
+    case 0x37: { // calloc
+      uint32_t size = a0 * a1;
+      uint32_t address = malloc(size);
+
+      for (uint32_t i = 0; address != 0 && i < size; i++) {
+        write_byte(address + i, 0);
+      }
+
+      return ret(address);
+    }
+
+    case 0x38: { // realloc
+      if (a0 == 0) {
+        return ret(malloc(a1));
+      }
+
+      if (a1 == 0) {
+        free(a0);
+        return ret(0);
+      }
+
+      uint32_t address = malloc(a1);
+      if (address == 0) {
+        return ret(0);
+      }
+
+      for (auto &block : heap) {
+        if (block.address == a0) {
+          for (uint32_t i = 0; i < block.size && i < a1; i++) {
+            write_byte(address + i, read_byte(a0 + i));
+          }
+        }
+      }
+
+      free(a0);
+      return ret(address);
+    }
+
+    case 0x39: // InitHeap
+      heap.clear();
+      heap.push_back({ a0, a1 & ~3, false });
+      return ret(0);
+
+    case 0x3a: // _exit
+      printf("[hle] exit(%d)\n", a0);
+      return halt();
+
+    case 0x3b: // getchar
+      return ret(0xffffffff);
+
+    case 0x3c: // putchar
+      putchar(int(a0 & 0xff));
+      return ret(a0);
+
+    case 0x3e: // puts
+      puts(read_string(a0).c_str());
+      return ret(0);
+
+    case 0x3f: { // printf
+      std::string text = format(a0, 1);
+      fputs(text.c_str(), stdout);
+
+      return ret(uint32_t(text.size()));
+    }
+
+    case 0x44: // FlushCache
+      cpu->flush_icache();
+      return ret(0);
+
+    case 0x48: // SendGP1Command
+      write_word(0x1f801814, a0);
+      return ret(0);
+
+    case 0x49: // GPU_cw
+      write_word(0x1f801810, a0);
+      return ret(0);
+
+    case 0x4a: // GPU_cwp
+      for (uint32_t i = 0; i < a1; i++) {
+        write_word(0x1f801810, read_word(a0 + (i * 4)));
+      }
+
+      return ret(0);
+
+    case 0x4d: // GetGPUStatus
+      return ret(read_word(0x1f801814));
+
+    case 0x51: // LoadExec
+      if (load_exe(read_string(a0), (a1 != 0) ? a1 + a2 : stack_top) == false) {
+        return ret(0);
+      }
+
+      return;
+
+    case 0x9d: // GetConf
+      write_word(a0, 16);
+      write_word(a1, 4);
+      write_word(a2, stack_top);
+      return ret(0);
+
+    case 0xa1: // SystemError
+      printf("[hle] SystemError(%c, %d)\n", char(a0), a1);
+      return halt();
+
+    case 0x45: // init_a0_b0_c0_vectors
+    case 0x70: // _bu_init
+    case 0x71: // _96_init
+    case 0x72: // _96_remove
+    case 0x96: // AddCDROMDevice
+    case 0x97: // AddMemCardDevice
+    case 0x99: // AddDummyTtyDevice
+    case 0x9c: // SetConf
+    case 0x9f: // SetMem
+    case 0xa2: // EnqueueCdIntr
+    case 0xa3: // DequeueCdIntr
+      return ret(0);
+  }
+
+  unimplemented('A', function);
+}
+
+
+void bios_hle_t::call_b0(uint32_t function) {
+  uint32_t a0 = get_arg(0);
+  uint32_t a1 = get_arg(1);
+  uint32_t a2 = get_arg(2);
+  uint32_t a3 = get_arg(3);
+
+  switch (function) {
+    case 0x00: { // alloc_kernel_memory
+      uint32_t size = (a0 + 3) & ~3;
+
+      if (kernel_memory + size > kernel_memory_end) {
+        return ret(0);
+      }
+
+      kernel_memory += size;
+      return ret(kernel_memory - size);
+    }
+
+    case 0x01: // free_kernel_memory
+      return ret(1);
+
+    case 0x02: // init_timer
+      init_timer(a0, a1, a2);
+      return ret(1);
+
+    case 0x03: // get_timer
+      return ret((a0 < 3) ? read_word(0x1f801100 + (a0 * 16)) & 0xffff : 0);
+
+    case 0x04: // enable_timer_irq
+    case 0x05: { // disable_timer_irq
+      uint32_t flag = (a0 < 3) ? (0x10 << a0) : 0x01;
+      uint32_t mask = read_word(0x1f801074);
+
+      write_word(0x1f801074, (function == 0x04) ? (mask | flag) : (mask & ~flag));
+      return ret(1);
+    }
+
+    case 0x06: // restart_timer
+      if (a0 < 3) {
+        write_word(0x1f801100 + (a0 * 16), 0);
+      }
+
+      return ret(1);
+
+    case 0x07: { // DeliverEvent
+      uint32_t ra = cpu->regs.gp[31];
+
+      return deliver_event(a0, a1, 0, [=]() {
+        cpu->regs.gp[31] = ra;
+        ret(0);
+      });
+    }
+
+    case 0x08: // OpenEvent
+      return ret(open_event(a0, a1, a2, a3));
+
+    case 0x09: // CloseEvent
+      if (event_t *event = get_event(a0)) {
+        event->status = 0;
+      }
+
+      return ret(1);
+
+    case 0x0a: { // WaitEvent
+      event_t *event = get_event(a0);
+
+      if (event == nullptr || event->status == 0x1000) {
+        return ret(0);
+      }
+
+      if (event->status == 0x4000) {
+        event->status = 0x2000;
+        return ret(1);
+      }
+
+      // not ready yet, spin on the trap until an interrupt delivers it
+
+      return jump(cpu->regs.this_pc);
+    }
+
+    case 0x0b: { // TestEvent
+      event_t *event = get_event(a0);
+
+      if (event != nullptr && event->status == 0x4000) {
+        event->status = 0x2000;
+        return ret(1);
+      }
+
+      return ret(0);
+    }
+
+    case 0x0c: // EnableEvent
+    case 0x0d: // DisableEvent
+      if (event_t *event = get_event(a0)) {
+        event->status = (function == 0x0c) ? 0x2000 : 0x1000;
+      }
+
+      return ret(1);
+
+    case 0x0e: // OpenThread
+      return ret(0xffffffff);
+
+    case 0x0f: // CloseThread
+      return ret(1);
+
+    case 0x10: // ChangeThread
+      return ret(0xffffffff);
+
+    case 0x12: // InitPad
+      pad_buffers[0] = a0;
+      pad_buffers[1] = a2;
+      return ret(2);
+
+    case 0x13: // StartPad
+      pad_started = true;
+      write_word(0x1f801074, read_word(0x1f801074) | 1);
+      return ret(1);
+
+    case 0x14: // StopPad
+      pad_started = false;
+      return ret(1);
+
+    case 0x16: // OutdatedPadGetButtons
+      return ret(0xffff);
+
+    case 0x17: // ReturnFromException
+      return return_from_exception();
+
+    case 0x18: // SetDefaultExitFromException
+      custom_exit = 0;
+      return ret(0);
+
+    case 0x19: // SetCustomExitFromException
+      custom_exit = a0;
+      return ret(0);
+
+    case 0x20: // UnDeliverEvent
+      for (auto &event : events) {
+        if (event.status == 0x4000 && event.mode == 0x2000 && event.class_id == a0 && event.spec == a1) {
+          event.status = 0x2000;
+        }
+      }
+
+      return ret(0);
+
+    case 0x32: // FileOpen
+      return ret(file_open(read_string(a0)));
+
+    case 0x34: // FileRead
+      return ret(file_read(a0, a1, a2));
+
+    case 0x33: // FileSeek
+    case 0x35: // FileWrite
+    case 0x36: // FileClose
+      return call_a0(function - 0x32);
+
+    case 0x3d: // putchar
+    case 0x3f: // puts
+      return call_a0(function - 0x01);
+
+    case 0x42: // firstfile
+    case 0x43: // nextfile
+      return ret(0);
+
+    case 0x5b: { // ChangeClearPad
+      bool old = clear_pad;
+      clear_pad = a0 != 0;
+
+      return ret(old);
+    }
+
+    case 0x4a: // InitCard
+    case 0x4b: // StartCard
+    case 0x4c: // StopCard
+    case 0x50: // allow_new_card
+      return ret(1);
+  }
+
+  unimplemented('B', function);
+}
+
+
+void bios_hle_t::call_c0(uint32_t function) {
+  uint32_t a0 = get_arg(0);
+  uint32_t a1 = get_arg(1);
+
+  switch (function) {
+    case 0x00: // EnqueueTimerAndVblankIrqs
+      timer_irqs_enabled = true;
+      return ret(0);
+
+    case 0x02: // SysEnqIntRP
+      write_word(a1, int_chains[a0 & 3]);
+      int_chains[a0 & 3] = a1;
+      return ret(0);
+
+    case 0x03: { // SysDeqIntRP
+      uint32_t entry = int_chains[a0 & 3];
+
+      if (entry == a1) {
+        int_chains[a0 & 3] = read_word(a1);
+        return ret(0);
+      }
+
+      while (entry != 0) {
+        uint32_t next = read_word(entry);
+
+        if (next == a1) {
+          write_word(entry, read_word(a1));
+          break;
+        }
+
+        entry = next;
+      }
+
+      return ret(0);
+    }
+
+    case 0x0a: { // ChangeClearRCnt
+      bool old = clear_rcnt[a0 & 3];
+      clear_rcnt[a0 & 3] = a1 != 0;
+
+      return ret(old);
+    }
+
+    case 0x01: // EnqueueSyscallHandler
+    case 0x07: // InstallExceptionHandlers
+    case 0x08: // SysInitMemory
+    case 0x0c: // InitDefInt
+    case 0x12: // InstallDevices
+    case 0x1c: // AdjustA0Table
+      return ret(0);
+  }
+
+  unimplemented('C', function);
+}
+
+
+void bios_hle_t::unimplemented(char table, uint32_t function) {
+  printf("[hle] unimplemented %c0:%02x\n", table, function);
+  ret(0);
+}
+
+
+// --====================--
+//   Services
+// --====================--
+
+
+uint32_t bios_hle_t::malloc(uint32_t size) {
+  size = (size + 3) & ~3;
+
+  for (size_t i = 0; i < heap.size(); i++) {
+    if (heap[i].used || heap[i].size < size) {
+      continue;
+    }
+
+    if (heap[i].size > size) {
+      heap_block_t rest = { heap[i].address + size, heap[i].size - size, false };
+      heap[i].size = size;
+      heap.insert(heap.begin() + i + 1, rest);
+    }
+
+    heap[i].used = true;
+    return heap[i].address;
+  }
+
+  return 0;
+}
+
+
+void bios_hle_t::free(uint32_t address) {
+  for (size_t i = 0; i < heap.size(); i++) {
+    if (heap[i].address != address || heap[i].used == false) {
+      continue;
+    }
+
+    heap[i].used = false;
+
+    if (i + 1 < heap.size() && heap[i + 1].used == false) {
+      heap[i].size += heap[i + 1].size;
+      heap.erase(heap.begin() + i + 1);
+    }
+
+    if (i > 0 && heap[i - 1].used == false) {
+      heap[i - 1].size += heap[i].size;
+      heap.erase(heap.begin() + i);
+    }
+
+    return;
+  }
+}
+
+
+void bios_hle_t::init_timer(uint32_t timer, uint32_t reload, uint32_t flags) {
+  if (timer >= 3) {
+    return;
+  }
+
+  // flags are the libapi RCntMd* bits: $1000 irq, $0010 gate, $0001 system
+  // clock instead of the timer's other source.
+
+  uint32_t mode = 0x0048;
+
+  if (flags & 0x1000) { mode |= 0x0010; }
+  if (flags & 0x0010) { mode |= 0x0001; }
+  if ((flags & 0x0001) == 0) { mode |= (timer == 2) ? 0x0200 : 0x0100; }
+
+  write_word(0x1f801104 + (timer * 16), 0);
+  write_word(0x1f801108 + (timer * 16), reload & 0xffff);
+  write_word(0x1f801104 + (timer * 16), mode);
+}
+
+
+std::string bios_hle_t::format(uint32_t format, int first_arg) {
+  std::string result;
+  int arg = first_arg;
+
+  while (uint32_t c = read_byte(format++)) {
+    if (c != '%') {
+      result += char(c);
+      continue;
+    }
+
+    std::string spec = "%";
+
+    while ((c = read_byte(format++)) != 0 && strchr("-+ #0123456789.lh", int(c))) {
+      if (c != 'l' && c != 'h') {
+        spec += char(c);
+      }
+    }
+
+    if (c == 0) {
+      break;
+    }
+
+    char buffer[256];
+
+    switch (c) {
+      case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+        spec += char(c);
+        snprintf(buffer, sizeof(buffer), spec.c_str(), get_arg(arg++));
+        result += buffer;
+        break;
+
+      case 'p':
+        spec += 'x';
+        snprintf(buffer, sizeof(buffer), spec.c_str(), get_arg(arg++));
+        result += buffer;
+        break;
+
+      case 's':
+        spec += 's';
+        snprintf(buffer, sizeof(buffer), spec.c_str(), read_string(get_arg(arg++)).c_str());
+        result += buffer;
+        break;
+
+      default:
+        result += char(c);
+        break;
+    }
+  }
+
+  return result;
+}
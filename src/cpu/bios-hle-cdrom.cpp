@@ -0,0 +1,266 @@
+#include "cpu/bios-hle.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include "cpu/cpu.hpp"
+
+
+// --====================--
+//   CD-ROM file system
+// --====================--
+//
+// Files are read straight out of the disc image, the drive itself is left
+// alone. Images are either raw 2352-byte mode 2 sectors, or plain 2048-byte
+// ISO sectors.
+
+
+static uint32_t get_word(const uint8_t *buffer) {
+  return
+    (buffer[0] <<  0) |
+    (buffer[1] <<  8) |
+    (buffer[2] << 16) |
+    (buffer[3] << 24);
+}
+
+
+static std::string get_name(std::string name) {
+  // names are compared without the version suffix, ignoring case
+
+  size_t version = name.find(';');
+  if (version != std::string::npos) {
+    name.erase(version);
+  }
+
+  for (auto &c : name) {
+    c = char(toupper(c));
+  }
+
+  return name;
+}
+
+
+bool bios_hle_t::read_sector(uint32_t lba, uint8_t *buffer) {
+  if (game_file == nullptr) {
+    return false;
+  }
+
+  long position = game_file_raw
+    ? (long(lba) * 2352) + 24
+    : (long(lba) * 2048)
+    ;
+
+  return
+    fseek(game_file, position, SEEK_SET) == 0 &&
+    fread(buffer, 1, 2048, game_file) == 2048;
+}
+
+
+bool bios_hle_t::find_file(std::string path, uint32_t *lba, uint32_t *size) {
+  uint8_t buffer[2048];
+
+  size_t device = path.find(':');
+  if (device != std::string::npos) {
+    path.erase(0, device + 1);
+  }
+
+  // the root directory record is in the primary volume descriptor
+
+  if (read_sector(16, buffer) == false || memcmp(&buffer[1], "CD001", 5) != 0) {
+    return false;
+  }
+
+  uint32_t dir_lba = get_word(&buffer[156 + 2]);
+  uint32_t dir_size = get_word(&buffer[156 + 10]);
+
+  while (path.size()) {
+    size_t separator = path.find_first_of("\\/");
+    std::string name = get_name(path.substr(0, separator));
+
+    path = (separator == std::string::npos)
+      ? ""
+      : path.substr(separator + 1)
+      ;
+
+    if (name.empty()) {
+      continue;
+    }
+
+    bool found = false;
+
+    for (uint32_t sector = 0; sector < (dir_size + 2047) / 2048 && found == false; sector++) {
+      if (read_sector(dir_lba + sector, buffer) == false) {
+        return false;
+      }
+
+      for (uint32_t offset = 0; offset < 2048 && buffer[offset] != 0; offset += buffer[offset]) {
+        const uint8_t *record = &buffer[offset];
+        std::string record_name((const char *)&record[33], record[32]);
+
+        if (get_name(record_name) == name) {
+          dir_lba = get_word(&record[2]);
+          dir_size = get_word(&record[10]);
+          found = true;
+          break;
+        }
+      }
+    }
+
+    if (found == false) {
+      return false;
+    }
+  }
+
+  *lba = dir_lba;
+  *size = dir_size;
+
+  return true;
+}
+
+
+bool bios_hle_t::read_file(uint32_t lba, uint32_t offset, uint32_t address, uint32_t size) {
+  uint8_t buffer[2048];
+
+  while (size) {
+    if (read_sector(lba + (offset / 2048), buffer) == false) {
+      return false;
+    }
+
+    uint32_t start = offset % 2048;
+    uint32_t count = std::min(size, 2048 - start);
+
+    for (uint32_t i = 0; i < count; i++) {
+      write_byte(address + i, buffer[start + i]);
+    }
+
+    offset += count;
+    address += count;
+    size -= count;
+  }
+
+  return true;
+}
+
+
+bool bios_hle_t::load_exe(const std::string &path, uint32_t stack) {
+  uint32_t lba;
+  uint32_t size;
+  uint8_t header[2048];
+
+  if (find_file(path, &lba, &size) == false ||
+      read_sector(lba, header) == false ||
+      memcmp(header, "PS-X EXE", 8) != 0) {
+    return false;
+  }
+
+  uint32_t text_address = get_word(&header[0x18]);
+  uint32_t text_size = get_word(&header[0x1c]);
+
+  printf("[hle] loading `%s'\n", path.c_str());
+
+  if (read_file(lba, 2048, text_address, text_size) == false) {
+    return false;
+  }
+
+  cpu->regs.gp[4] = 0;
+  cpu->regs.gp[5] = 0;
+  cpu->regs.gp[31] = halt_address;
+  cpu->start_exe(header, stack);
+
+  return true;
+}
+
+
+void bios_hle_t::load_system_cnf(std::string *boot, uint32_t *stack) {
+  uint32_t lba;
+  uint32_t size;
+  uint8_t buffer[2048];
+
+  if (find_file("cdrom:\\SYSTEM.CNF;1", &lba, &size) == false ||
+      read_sector(lba, buffer) == false) {
+    return;
+  }
+
+  std::string text((const char *)buffer, std::min(size, 2048u));
+  size_t start = 0;
+
+  while (start < text.size()) {
+    size_t end = text.find_first_of("\r\n", start);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+
+    std::string line = text.substr(start, end - start);
+    start = end + 1;
+
+    size_t equals = line.find('=');
+    if (equals == std::string::npos) {
+      continue;
+    }
+
+    std::string key = line.substr(0, equals);
+    std::string value = line.substr(equals + 1);
+
+    key.erase(0, key.find_first_not_of(" \t"));
+    key.erase(key.find_last_not_of(" \t") + 1);
+    value.erase(0, value.find_first_not_of(" \t"));
+    value.erase(value.find_last_not_of(" \t") + 1);
+
+    if (key == "BOOT") {
+      *boot = value;
+    }
+    else if (key == "STACK") {
+      *stack = uint32_t(strtoul(value.c_str(), nullptr, 16));
+    }
+  }
+}
+
+
+uint32_t bios_hle_t::file_open(const std::string &path) {
+  if (path.compare(0, 6, "cdrom:") != 0) {
+    return 0xffffffff;
+  }
+
+  for (uint32_t fd = 2; fd < 16; fd++) {
+    file_t &file = files[fd];
+
+    if (file.open) {
+      continue;
+    }
+
+    if (find_file(path, &file.lba, &file.size) == false) {
+      return 0xffffffff;
+    }
+
+    file.open = true;
+    file.position = 0;
+
+    return fd;
+  }
+
+  return 0xffffffff;
+}
+
+
+uint32_t bios_hle_t::file_read(uint32_t fd, uint32_t address, uint32_t size) {
+  if (fd >= 16 || files[fd].open == false) {
+    return 0xffffffff;
+  }
+
+  file_t &file = files[fd];
+
+  if (file.position >= file.size) {
+    return 0;
+  }
+
+  size = std::min(size, file.size - file.position);
+
+  if (read_file(file.lba, file.position, address, size) == false) {
+    return 0xffffffff;
+  }
+
+  file.position += size;
+
+  return size;
+}
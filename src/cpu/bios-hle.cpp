@@ -0,0 +1,456 @@
+#include "cpu/bios-hle.hpp"
+
+#include <cstring>
+#include "cpu/cpu.hpp"
+
+
+// --====================--
+//   HLE kernel
+// --====================--
+//
+// The kernel lives in the first 64 KiB of WRAM like the real one does, but
+// only the entry points hold code. Everything a game can ask the kernel to
+// do is implemented on the host, and calls back into the game (interrupt
+// handlers, event callbacks) return to a trap that picks up where the host
+// left off.
+
+
+bios_hle_t::bios_hle_t(cpu_t *cpu, memory_access_t *memory, const char *game_file_name, const char *exe_file_name)
+  : cpu(cpu)
+  , memory(memory)
+  , exe_file_name(exe_file_name != nullptr ? exe_file_name : "") {
+
+  game_file = nullptr;
+  game_file_raw = true;
+
+  if (game_file_name != nullptr && game_file_name[0] != '\0') {
+    game_file = fopen(game_file_name, "rb");
+  }
+
+  if (game_file != nullptr) {
+    fseek(game_file, 0, SEEK_END);
+    game_file_raw = (ftell(game_file) % 2352) == 0;
+  }
+
+  // the reset vector boots straight into the kernel
+
+  write_trap(0xbfc00000, trap_boot);
+}
+
+
+bios_hle_t::~bios_hle_t() {
+  if (game_file != nullptr) {
+    fclose(game_file);
+  }
+}
+
+
+void bios_hle_t::trap(uint32_t vector) {
+  switch (vector) {
+    case trap_boot:
+      return boot();
+
+    case trap_exception:
+      return exception();
+
+    case trap_a0:
+      return call_a0(cpu->regs.gp[9] & 0xff);
+
+    case trap_b0:
+      return call_b0(cpu->regs.gp[9] & 0xff);
+
+    case trap_c0:
+      return call_c0(cpu->regs.gp[9] & 0xff);
+
+    case trap_return: {
+      if (continuations.empty()) {
+        printf("[hle] return from a function the kernel didn't call\n");
+        return halt();
+      }
+
+      std::function<void()> next = continuations.back();
+      continuations.pop_back();
+
+      return next();
+    }
+
+    case trap_halt:
+      return jump(cpu->regs.this_pc);
+  }
+
+  printf("[hle] unknown trap $%02x\n", vector);
+  halt();
+}
+
+
+void bios_hle_t::boot() {
+  write_trap(0x80000080, trap_exception);
+  write_trap(0x800000a0, trap_a0);
+  write_trap(0x800000b0, trap_b0);
+  write_trap(0x800000c0, trap_c0);
+  write_trap(0xbfc00180, trap_exception);
+  write_trap(return_address, trap_return);
+  write_trap(halt_address, trap_halt);
+
+  memset(events, 0, sizeof(events));
+  memset(files, 0, sizeof(files));
+  memset(int_chains, 0, sizeof(int_chains));
+  memset(&frame, 0, sizeof(frame));
+
+  heap.clear();
+  continuations.clear();
+  exception_depth = 0;
+
+  kernel_memory = kernel_memory_start;
+  rand_seed = 1;
+  stack_top = 0x801ffff0;
+
+  timer_irqs_enabled = false;
+  clear_rcnt[0] = true;
+  clear_rcnt[1] = true;
+  clear_rcnt[2] = true;
+  clear_rcnt[3] = true;
+  clear_pad = true;
+  custom_exit = 0;
+  pending_irqs = 0;
+
+  pad_buffers[0] = 0;
+  pad_buffers[1] = 0;
+  pad_started = false;
+
+  cpu->get_cop(0)->write_gpr(12, 0x00000401);
+
+  if (exe_file_name.size()) {
+    cpu->regs.gp[29] = stack_top;
+    cpu->regs.gp[31] = halt_address;
+
+    if (cpu->load_exe(exe_file_name.c_str()) == false) {
+      return halt();
+    }
+
+    return;
+  }
+
+  if (game_file == nullptr) {
+    printf("[hle] no game to boot\n");
+    return halt();
+  }
+
+  std::string boot = "cdrom:PSX.EXE;1";
+  uint32_t stack = stack_top;
+
+  load_system_cnf(&boot, &stack);
+
+  if (load_exe(boot, stack) == false) {
+    printf("[hle] unable to boot `%s'\n", boot.c_str());
+    return halt();
+  }
+}
+
+
+void bios_hle_t::halt() {
+  jump(halt_address);
+}
+
+
+// --====================--
+//   Exceptions
+// --====================--
+
+
+void bios_hle_t::exception() {
+  cpu_cop_t *cop0 = cpu->get_cop(0);
+
+  memcpy(frame.gp, cpu->regs.gp, sizeof(frame.gp));
+  frame.lo = cpu->regs.lo;
+  frame.hi = cpu->regs.hi;
+  frame.epc = cop0->read_gpr(14);
+
+  exception_depth = continuations.size();
+
+  uint32_t code = (cop0->read_gpr(13) >> 2) & 0x1f;
+
+  switch (code) {
+    case 0x00: // interrupt
+      cpu->regs.gp[29] = exception_stack;
+      return dispatch_interrupt(0, int_chains[0]);
+
+    case 0x08: { // syscall
+      uint32_t sr = cop0->read_gpr(12);
+
+      // the status register has been pushed, so the bits that come back on
+      // rfe are the previous ones.
+
+      switch (frame.gp[4]) {
+        case 0x01: // EnterCriticalSection
+          frame.gp[2] = (sr & 0x404) == 0x404;
+          sr &= ~0x404;
+          break;
+
+        case 0x02: // ExitCriticalSection
+          sr |= 0x404;
+          break;
+      }
+
+      cop0->write_gpr(12, sr);
+      frame.epc += 4;
+
+      return return_from_exception();
+    }
+  }
+
+  printf("[hle] unhandled exception $%02x at $%08x\n", code, frame.epc);
+  halt();
+}
+
+
+void bios_hle_t::dispatch_interrupt(int priority, uint32_t entry) {
+  // each chain entry is {next, handler, verifier}. the handler only runs
+  // when the verifier returns non-zero, and gets that value passed in.
+
+  while (priority < 4) {
+    if (entry == 0) {
+      priority++;
+      entry = (priority < 4) ? int_chains[priority] : 0;
+      continue;
+    }
+
+    uint32_t next = read_word(entry + 0);
+    uint32_t handler = read_word(entry + 4);
+    uint32_t verifier = read_word(entry + 8);
+
+    if (verifier != 0) {
+      return call(verifier, 0, 0, [=]() {
+        uint32_t result = cpu->regs.gp[2];
+
+        if (result != 0 && handler != 0) {
+          return call(handler, result, 0, [=]() {
+            dispatch_interrupt(priority, next);
+          });
+        }
+
+        dispatch_interrupt(priority, next);
+      });
+    }
+
+    entry = next;
+  }
+
+  pending_irqs = read_word(0x1f801070) & read_word(0x1f801074);
+
+  if ((pending_irqs & 1) && pad_started) {
+    if (pad_buffers[0] != 0) {
+      write_byte(pad_buffers[0] + 0, 0x00);
+      write_byte(pad_buffers[0] + 1, 0x41);
+      write_byte(pad_buffers[0] + 2, 0xff);
+      write_byte(pad_buffers[0] + 3, 0xff);
+    }
+
+    if (pad_buffers[1] != 0) {
+      write_byte(pad_buffers[1] + 0, 0xff);
+    }
+  }
+
+  default_interrupts(0);
+}
+
+
+void bios_hle_t::default_interrupts(int timer) {
+  // the handlers installed by EnqueueTimerAndVblankIrqs turn timer and vblank
+  // interrupts into events. timer 3 is vblank.
+
+  for (; timer < 4 && timer_irqs_enabled; timer++) {
+    uint32_t flag = (timer == 3) ? 0x01 : (0x10 << timer);
+
+    if (pending_irqs & flag) {
+      pending_irqs &= ~flag;
+
+      if (clear_rcnt[timer]) {
+        write_word(0x1f801070, ~flag);
+      }
+
+      return deliver_event(0xf2000000 + timer, 0x0002, 0, [=]() {
+        default_interrupts(timer + 1);
+      });
+    }
+  }
+
+  if ((pending_irqs & 1) && pad_started && clear_pad) {
+    write_word(0x1f801070, ~1);
+  }
+
+  exit_exception();
+}
+
+
+void bios_hle_t::exit_exception() {
+  if (custom_exit == 0) {
+    return return_from_exception();
+  }
+
+  // the custom exit is a setjmp buffer, interrupts stay off until the game
+  // calls ReturnFromException.
+
+  continuations.resize(exception_depth);
+
+  cpu->regs.gp[31] = read_word(custom_exit + 0x00);
+  cpu->regs.gp[29] = read_word(custom_exit + 0x04);
+  cpu->regs.gp[30] = read_word(custom_exit + 0x08);
+
+  for (int i = 0; i < 8; i++) {
+    cpu->regs.gp[16 + i] = read_word(custom_exit + 0x0c + (i * 4));
+  }
+
+  cpu->regs.gp[28] = read_word(custom_exit + 0x2c);
+
+  ret(1);
+}
+
+
+void bios_hle_t::return_from_exception() {
+  continuations.resize(exception_depth);
+
+  memcpy(cpu->regs.gp, frame.gp, sizeof(frame.gp));
+  cpu->regs.gp[0] = 0;
+  cpu->regs.lo = frame.lo;
+  cpu->regs.hi = frame.hi;
+
+  uint32_t sr = cpu->get_cop(0)->read_gpr(12);
+  sr = (sr & ~0xf) | ((sr >> 2) & 0xf);
+
+  cpu->get_cop(0)->write_gpr(12, sr);
+
+  jump(frame.epc);
+}
+
+
+// --====================--
+//   Events
+// --====================--
+
+
+void bios_hle_t::deliver_event(uint32_t class_id, uint32_t spec, int index, std::function<void()> next) {
+  for (; index < 32; index++) {
+    event_t &event = events[index];
+
+    if (event.status != 0x2000 || event.class_id != class_id || event.spec != spec) {
+      continue;
+    }
+
+    if (event.mode == 0x2000) {
+      event.status = 0x4000;
+    }
+    else if (event.mode == 0x1000 && event.func != 0) {
+      return call(event.func, 0, 0, [=]() {
+        deliver_event(class_id, spec, index + 1, next);
+      });
+    }
+  }
+
+  next();
+}
+
+
+uint32_t bios_hle_t::open_event(uint32_t class_id, uint32_t spec, uint32_t mode, uint32_t func) {
+  for (uint32_t index = 0; index < 32; index++) {
+    event_t &event = events[index];
+
+    if (event.status == 0) {
+      event.class_id = class_id;
+      event.spec = spec;
+      event.mode = mode;
+      event.func = func;
+      event.status = 0x1000;
+
+      return 0xf1000000 | index;
+    }
+  }
+
+  return 0xffffffff;
+}
+
+
+bios_hle_t::event_t *bios_hle_t::get_event(uint32_t handle) {
+  uint32_t index = handle & 0xffff;
+
+  if ((handle >> 24) != 0xf1 || index >= 32 || events[index].status == 0) {
+    return nullptr;
+  }
+
+  return &events[index];
+}
+
+
+// --====================--
+//   Guest access
+// --====================--
+
+
+uint32_t bios_hle_t::get_arg(int n) {
+  // arguments past the fourth are on the stack, after the space reserved for
+  // the first four.
+
+  return (n < 4)
+    ? cpu->regs.gp[4 + n]
+    : read_word(cpu->regs.gp[29] + (n * 4))
+    ;
+}
+
+
+void bios_hle_t::ret(uint32_t value) {
+  cpu->regs.gp[2] = value;
+  jump(cpu->regs.gp[31]);
+}
+
+
+void bios_hle_t::jump(uint32_t address) {
+  cpu->regs.pc = address;
+  cpu->regs.next_pc = address + 4;
+}
+
+
+void bios_hle_t::call(uint32_t function, uint32_t arg0, uint32_t arg1, std::function<void()> next) {
+  continuations.push_back(next);
+
+  cpu->regs.gp[4] = arg0;
+  cpu->regs.gp[5] = arg1;
+  cpu->regs.gp[31] = return_address;
+
+  jump(function);
+}
+
+
+uint32_t bios_hle_t::read_byte(uint32_t address) {
+  return memory->read_byte(cpu_t::map_address(address));
+}
+
+
+uint32_t bios_hle_t::read_word(uint32_t address) {
+  return memory->read_word(cpu_t::map_address(address));
+}
+
+
+void bios_hle_t::write_byte(uint32_t address, uint32_t data) {
+  memory->write_byte(cpu_t::map_address(address), data);
+}
+
+
+void bios_hle_t::write_word(uint32_t address, uint32_t data) {
+  memory->write_word(cpu_t::map_address(address), data);
+}
+
+
+std::string bios_hle_t::read_string(uint32_t address) {
+  std::string result;
+
+  while (uint32_t c = read_byte(address++)) {
+    result += char(c);
+  }
+
+  return result;
+}
+
+
+void bios_hle_t::write_trap(uint32_t address, uint32_t vector) {
+  write_word(address, trap_code | vector);
+}
@@ -0,0 +1,211 @@
+#ifndef __psxact_bios_hle__
+#define __psxact_bios_hle__
+
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+#include "memory-access.hpp"
+
+
+class cpu_t;
+
+
+// High-level emulation of the BIOS kernel. The kernel entry points are
+// filled with a trap instruction, and the host implements the A0/B0/C0
+// calls, the exception handler and the boot sequence.
+
+class bios_hle_t {
+public:
+
+  // primary opcode $3f doesn't exist on the r3000a, the low bits select what
+  // the trap does.
+
+  static const uint32_t trap_code = 0xfc000000;
+
+  enum {
+    trap_boot,
+    trap_exception,
+    trap_a0,
+    trap_b0,
+    trap_c0,
+    trap_return,
+    trap_halt
+  };
+
+  // kernel memory layout
+
+  static const uint32_t return_address = 0x80000400;
+  static const uint32_t halt_address = 0x80000404;
+  static const uint32_t exception_stack = 0x80007ff0;
+  static const uint32_t kernel_memory_start = 0x80008000;
+  static const uint32_t kernel_memory_end = 0x80010000;
+
+private:
+
+  cpu_t *cpu;
+
+  memory_access_t *memory;
+
+  FILE *game_file;
+  bool game_file_raw;
+
+  std::string exe_file_name;
+
+  struct event_t {
+    uint32_t class_id;
+    uint32_t spec;
+    uint32_t mode;
+    uint32_t status;
+    uint32_t func;
+  };
+
+  event_t events[32];
+
+  struct file_t {
+    bool open;
+    uint32_t lba;
+    uint32_t size;
+    uint32_t position;
+  };
+
+  file_t files[16];
+
+  struct heap_block_t {
+    uint32_t address;
+    uint32_t size;
+    bool used;
+  };
+
+  std::vector<heap_block_t> heap;
+
+  uint32_t kernel_memory;
+  uint32_t rand_seed;
+  uint32_t stack_top;
+
+  // interrupt handling
+
+  uint32_t int_chains[4];
+  bool timer_irqs_enabled;
+  bool clear_rcnt[4];
+  bool clear_pad;
+  uint32_t custom_exit;
+  uint32_t pending_irqs;
+
+  uint32_t pad_buffers[2];
+  bool pad_started;
+
+  struct {
+    uint32_t gp[32];
+    uint32_t lo;
+    uint32_t hi;
+    uint32_t epc;
+  } frame;
+
+  // guest functions called from the kernel return to a trap, which resumes
+  // the host code that called them.
+
+  std::vector<std::function<void()>> continuations;
+  size_t exception_depth;
+
+public:
+
+  bios_hle_t(cpu_t *cpu, memory_access_t *memory, const char *game_file_name, const char *exe_file_name);
+
+  ~bios_hle_t();
+
+  void trap(uint32_t vector);
+
+private:
+
+  // -==========-
+  //  Kernel
+  // -==========-
+
+  void boot();
+
+  void halt();
+
+  void exception();
+
+  void dispatch_interrupt(int priority, uint32_t entry);
+
+  void default_interrupts(int timer);
+
+  void exit_exception();
+
+  void return_from_exception();
+
+  void call_a0(uint32_t function);
+
+  void call_b0(uint32_t function);
+
+  void call_c0(uint32_t function);
+
+  void unimplemented(char table, uint32_t function);
+
+  // -==========-
+  //  Services
+  // -==========-
+
+  void deliver_event(uint32_t class_id, uint32_t spec, int index, std::function<void()> next);
+
+  uint32_t open_event(uint32_t class_id, uint32_t spec, uint32_t mode, uint32_t func);
+
+  event_t *get_event(uint32_t handle);
+
+  uint32_t malloc(uint32_t size);
+
+  void free(uint32_t address);
+
+  void init_timer(uint32_t timer, uint32_t reload, uint32_t flags);
+
+  std::string format(uint32_t format, int first_arg);
+
+  // -==========-
+  //  CD-ROM
+  // -==========-
+
+  bool read_sector(uint32_t lba, uint8_t *buffer);
+
+  bool find_file(std::string path, uint32_t *lba, uint32_t *size);
+
+  bool read_file(uint32_t lba, uint32_t offset, uint32_t address, uint32_t size);
+
+  bool load_exe(const std::string &path, uint32_t stack);
+
+  void load_system_cnf(std::string *boot, uint32_t *stack);
+
+  uint32_t file_open(const std::string &path);
+
+  uint32_t file_read(uint32_t fd, uint32_t address, uint32_t size);
+
+  // -==========-
+  //  Guest
+  // -==========-
+
+  uint32_t get_arg(int n);
+
+  void ret(uint32_t value);
+
+  void jump(uint32_t address);
+
+  void call(uint32_t function, uint32_t arg0, uint32_t arg1, std::function<void()> next);
+
+  uint32_t read_byte(uint32_t address);
+
+  uint32_t read_word(uint32_t address);
+
+  void write_byte(uint32_t address, uint32_t data);
+
+  void write_word(uint32_t address, uint32_t data);
+
+  std::string read_string(uint32_t address);
+
+  void write_trap(uint32_t address, uint32_t vector);
+};
+
+
+#endif // __psxact_bios_hle__
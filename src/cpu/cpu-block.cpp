@@ -0,0 +1,405 @@
+#include "cpu/cpu.hpp"
+
+#include <algorithm>
+#include "limits.hpp"
+#include "utility.hpp"
+
+
+// --====================--
+//   Cached interpreter
+// --====================--
+//
+// Straight-line runs of code are decoded once into blocks of `op_t', which
+// end after the delay slot of the first branch or jump. Blocks are looked up
+// by physical address and thrown away when a write hits a page of WRAM that
+// one of them was decoded from.
+
+
+static uint32_t get_page(uint32_t address) {
+  return (address & (mib(2) - 1)) / kib(4);
+}
+
+
+bool cpu_t::is_branch_code(uint32_t code) {
+  switch (code >> 26) {
+    case 0x00:
+      return (code & 0x3e) == 0x08; // jr, jalr
+
+    case 0x01: // bxx
+    case 0x02: // j
+    case 0x03: // jal
+    case 0x04: // beq
+    case 0x05: // bne
+    case 0x06: // blez
+    case 0x07: // bgtz
+      return true;
+  }
+
+  return false;
+}
+
+
+cpu_t::block_t **cpu_t::get_block_slot(uint32_t address) {
+  if (address & 3) {
+    return nullptr;
+  }
+
+  address = map_address(address);
+
+  if (limits::between<0x00000000, 0x007fffff>(address)) {
+    return &wram_blocks[(address & (mib(2) - 1)) / 4];
+  }
+
+  if (limits::between<0x1fc00000, 0x1fc7ffff>(address)) {
+    return &bios_blocks[(address & (kib(512) - 1)) / 4];
+  }
+
+  return nullptr;
+}
+
+
+cpu_t::block_t *cpu_t::get_block(uint32_t address) {
+  if (retired_blocks.size()) {
+    for (auto block : retired_blocks) {
+      delete block;
+    }
+
+    retired_blocks.clear();
+  }
+
+  block_t **slot = get_block_slot(address);
+  if (slot == nullptr) {
+    return nullptr;
+  }
+
+  if (*slot == nullptr) {
+    *slot = compile_block(address);
+  }
+
+  return *slot;
+}
+
+
+cpu_t::block_t *cpu_t::compile_block(uint32_t address) {
+  uint32_t physical = map_address(address);
+  uint32_t limit = limits::between<0x00000000, 0x007fffff>(physical)
+    ? 0x00800000
+    : 0x1fc80000
+    ;
+
+  block_t *block = new block_t();
+  block->address = physical;
+  block->valid = true;
+
+  bool delay_slot = false;
+
+  for (uint32_t i = 0; physical + (i * 4) < limit; i++) {
+    op_t op;
+    decode(op, memory->read_word(physical + (i * 4)));
+
+    block->ops.push_back(op);
+
+    if (delay_slot) {
+      break;
+    }
+
+    delay_slot = is_branch_code(op.code);
+
+    if (delay_slot == false && block->ops.size() == size_t(block_max_length)) {
+      break;
+    }
+  }
+
+  block->idle = is_idle_loop(block);
+
+  if (limits::between<0x00000000, 0x007fffff>(physical)) {
+    block->first_page = get_page(physical);
+    block->last_page = get_page(physical + (block->ops.size() - 1) * 4);
+
+    watch_page(block->first_page, block);
+
+    if (block->last_page != block->first_page) {
+      watch_page(block->last_page, block);
+    }
+  }
+
+  return block;
+}
+
+
+void cpu_t::watch_page(uint32_t page, block_t *block) {
+  // stores into a page with code in it have to go through the slow path, so
+  // the blocks built from it can be thrown away.
+
+  if (wram_pages[page].empty()) {
+    memory->protect_code(page * kib(4));
+  }
+
+  wram_pages[page].push_back(block);
+}
+
+
+int cpu_t::run_block(block_t *block) {
+  int count = 0;
+
+  for (const op_t &op : block->ops) {
+    regs.this_pc = regs.pc;
+    regs.pc = regs.next_pc;
+    regs.next_pc += 4;
+
+    step(&op);
+    count++;
+
+    // leave as soon as control flow goes somewhere the block didn't expect,
+    // or a store just overwrote the code we're running.
+
+    if (regs.pc != regs.this_pc + 4 || block->valid == false) {
+      break;
+    }
+  }
+
+  return count;
+}
+
+
+void cpu_t::invalidate_code(uint32_t address) {
+  uint32_t page = get_page(address);
+
+  if (wram_pages[page].empty()) {
+    return;
+  }
+
+  std::vector<block_t *> blocks;
+  blocks.swap(wram_pages[page]);
+
+  memory->unprotect_code(address);
+
+  for (auto block : blocks) {
+    uint32_t other = (block->first_page == page)
+      ? block->last_page
+      : block->first_page
+      ;
+
+    if (other != page) {
+      auto &list = wram_pages[other];
+      list.erase(std::remove(list.begin(), list.end(), block), list.end());
+
+      if (list.empty()) {
+        memory->unprotect_code(other * kib(4));
+      }
+    }
+
+    wram_blocks[(block->address & (mib(2) - 1)) / 4] = nullptr;
+
+    // the block might be running right now, so it is only deleted on the next
+    // lookup.
+
+    block->valid = false;
+    retired_blocks.push_back(block);
+  }
+}
+
+
+void cpu_t::flush_blocks() {
+  for (auto &block : wram_blocks) {
+    delete block;
+    block = nullptr;
+  }
+
+  for (auto &block : bios_blocks) {
+    delete block;
+    block = nullptr;
+  }
+
+  for (uint32_t page = 0; page < mib(2) / kib(4); page++) {
+    if (wram_pages[page].size()) {
+      wram_pages[page].clear();
+      memory->unprotect_code(page * kib(4));
+    }
+  }
+
+  for (auto block : retired_blocks) {
+    delete block;
+  }
+
+  retired_blocks.clear();
+
+  native_cache_used = 0;
+}
+
+
+// --===========--
+//   Idle loops
+// --===========--
+//
+// A block that branches back to its own start, only loads and computes, and
+// doesn't carry any register from one iteration to the next does exactly the
+// same thing every time around until something else changes memory or an
+// interrupt comes in. Once it has gone around once, the console can skip
+// ahead to the next scheduled event.
+
+
+static bool get_idle_operands(uint32_t code, uint32_t *reads, uint32_t *writes, bool *load) {
+  uint32_t rs = 1 << ((code >> 21) & 31);
+  uint32_t rt = 1 << ((code >> 16) & 31);
+  uint32_t rd = 1 << ((code >> 11) & 31);
+
+  *load = false;
+
+  switch (code >> 26) {
+    case 0x00:
+      switch (code & 0x3f) {
+        case 0x00: case 0x02: case 0x03: // sll, srl, sra
+          *reads = rt; *writes = rd; return true;
+
+        case 0x04: case 0x06: case 0x07: // sllv, srlv, srav
+        case 0x21: case 0x23: // addu, subu
+        case 0x24: case 0x25: case 0x26: case 0x27: // and, or, xor, nor
+        case 0x2a: case 0x2b: // slt, sltu
+          *reads = rs | rt; *writes = rd; return true;
+
+        case 0x10: case 0x12: // mfhi, mflo
+          *reads = 0; *writes = rd; return true;
+      }
+      return false;
+
+    case 0x09: case 0x0a: case 0x0b: // addiu, slti, sltiu
+    case 0x0c: case 0x0d: case 0x0e: // andi, ori, xori
+      *reads = rs; *writes = rt; return true;
+
+    case 0x0f: // lui
+      *reads = 0; *writes = rt; return true;
+
+    case 0x20: case 0x21: case 0x23: // lb, lh, lw
+    case 0x24: case 0x25: // lbu, lhu
+      *reads = rs; *writes = rt; *load = true; return true;
+  }
+
+  return false;
+}
+
+
+static bool get_idle_branch(uint32_t code, uint32_t *reads) {
+  uint32_t rs = 1 << ((code >> 21) & 31);
+  uint32_t rt = 1 << ((code >> 16) & 31);
+
+  switch (code >> 26) {
+    case 0x01: // bltz, bgez
+      *reads = rs;
+      return ((code >> 16) & 31) <= 1;
+
+    case 0x04: // beq
+    case 0x05: // bne
+      *reads = rs | rt;
+      return true;
+
+    case 0x06: // blez
+    case 0x07: // bgtz
+      *reads = rs;
+      return true;
+  }
+
+  return false;
+}
+
+
+bool cpu_t::is_idle_loop(const block_t *block) {
+  int count = int(block->ops.size());
+  if (count < 2) {
+    return false;
+  }
+
+  int branch = count - 2;
+
+  uint32_t branch_reads;
+
+  if (get_idle_branch(block->ops[branch].code, &branch_reads) == false ||
+      branch + 1 + int(utility::sclip<16>(block->ops[branch].code)) != 0) {
+    return false;
+  }
+
+  // find every register the loop writes
+
+  uint32_t reads[block_max_length];
+  uint32_t writes[block_max_length];
+  bool loads[block_max_length];
+  uint32_t written_anywhere = 0;
+
+  for (int i = 0; i < count; i++) {
+    if (i == branch) {
+      reads[i] = branch_reads;
+      writes[i] = 0;
+      loads[i] = false;
+    }
+    else if (get_idle_operands(block->ops[i].code, &reads[i], &writes[i], &loads[i]) == false) {
+      return false;
+    }
+
+    written_anywhere |= writes[i];
+  }
+
+  if (loads[count - 1]) {
+    return false;
+  }
+
+  // a register that is read before the loop has written it this time around
+  // carries state between iterations. loads only count as written after
+  // their delay slot.
+
+  uint32_t written = 1;
+  uint32_t pending = 0;
+
+  for (int i = 0; i < count; i++) {
+    if (reads[i] & written_anywhere & ~written) {
+      return false;
+    }
+
+    written |= pending;
+    pending = 0;
+
+    if (loads[i]) {
+      pending = writes[i];
+    }
+    else {
+      written |= writes[i];
+    }
+  }
+
+  return true;
+}
+
+
+static bool is_idle_safe_address(uint32_t address) {
+  // memory, and registers that can only change when an event fires
+
+  if (limits::between<0x00000000, 0x007fffff>(address)) { return true; }
+  if (limits::between<0x1fc00000, 0x1fc7ffff>(address)) { return true; }
+  if (limits::between<0x1f800000, 0x1f800fff>(address)) { return true; }
+  if (limits::between<0x1f801070, 0x1f801077>(address)) { return true; } // i_stat, i_mask
+  if (limits::between<0x1f801080, 0x1f8010ff>(address)) { return true; } // dma
+  if (limits::between<0x1f801814, 0x1f801817>(address)) { return true; } // gpustat
+
+  return address == 0x1f801800 || address == 0x1f801803; // cdrom status, interrupt flags
+}
+
+
+bool cpu_t::is_idle_safe(const block_t *block) {
+  if (is_interrupt_pending()) {
+    return false;
+  }
+
+  // the base registers hold the same values every iteration, so the current
+  // ones tell us what the loop is polling.
+
+  for (const op_t &op : block->ops) {
+    if ((op.code >> 26) >= 0x20) {
+      uint32_t address = map_address(regs.gp[op.rs] + op.iconst);
+
+      if (is_idle_safe_address(address) == false) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
@@ -1,5 +1,6 @@
 #include "cpu/cpu.hpp"
 
+#include "cpu/bios-hle.hpp"
 #include "cpu/cpu-cop0.hpp"
 #include "cpu/cpu-cop2.hpp"
 #include "utility.hpp"
@@ -654,3 +655,12 @@ void cpu_t::op_xori() {
 void cpu_t::op_und() {
   enter_exception(cop0_exception_code_t::reserved_instruction);
 }
+
+
+void cpu_t::op_hle() {
+  if (hle == nullptr) {
+    return op_und();
+  }
+
+  hle->trap(code & 0x3ffffff);
+}
@@ -3,6 +3,7 @@
 
 
 #include <cstdint>
+#include "state.hpp"
 
 
 class cpu_cop_t {
@@ -19,6 +20,8 @@ public:
 
   virtual void write_gpr(uint32_t n, uint32_t value) = 0;
 
+  virtual void serialize(state_t &state) = 0;
+
 };
 
 
@@ -27,6 +27,11 @@ void cpu_cop0_t::write_gpr(uint32_t n, uint32_t value) {
 }
 
 
+void cpu_cop0_t::serialize(state_t &state) {
+  state.io(regs);
+}
+
+
 void cpu_cop0_t::rfe() {
   uint32_t sr = read_gpr(12);
   sr = (sr & ~0xf) | ((sr >> 2) & 0xf);
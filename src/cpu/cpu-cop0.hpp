@@ -42,6 +42,8 @@ public:
   uint32_t enter_exception(cop0_exception_code_t code, uint32_t pc, bool is_branch_delay_slot);
 
   void rfe();
+
+  void serialize(state_t &state);
 };
 
 
@@ -43,6 +43,12 @@ uint32_t cpu_cop2_t::divide() {
 }
 
 
+void cpu_cop2_t::serialize(state_t &state) {
+  state.io(ccr);
+  state.io(gpr);
+}
+
+
 void cpu_cop2_t::run(uint32_t code) {
   ccr.flag = 0;
 
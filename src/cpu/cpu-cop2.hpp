@@ -81,6 +81,8 @@ public:
 
   uint32_t divide();
 
+  void serialize(state_t &state);
+
 private:
 
   matrix get_mx(uint32_t code);
@@ -0,0 +1,87 @@
+#include "cpu/cpu.hpp"
+
+#include <cstring>
+#include <vector>
+
+
+// --====================--
+//   PS-X EXE loading
+// --====================--
+//
+// The header is one 2 KiB sector, followed by the text segment:
+//
+//   $10 pc, $14 gp, $18 text address, $1c text size,
+//   $28 bss address, $2c bss size, $30 stack address, $34 stack size
+
+
+static uint32_t get_word(const uint8_t *buffer) {
+  return
+    (buffer[0] <<  0) |
+    (buffer[1] <<  8) |
+    (buffer[2] << 16) |
+    (buffer[3] << 24);
+}
+
+
+bool cpu_t::load_exe(const char *file_name) {
+  FILE *file = fopen(file_name, "rb");
+  if (file == nullptr) {
+    printf("unable to load '%s'\n", file_name);
+    return false;
+  }
+
+  fseek(file, 0, SEEK_END);
+  std::vector<uint8_t> data(size_t(ftell(file)));
+  fseek(file, 0, SEEK_SET);
+
+  size_t size = fread(data.data(), 1, data.size(), file);
+  fclose(file);
+
+  if (size < 0x800 || memcmp(data.data(), "PS-X EXE", 8) != 0) {
+    printf("'%s' isn't a PS-X EXE\n", file_name);
+    return false;
+  }
+
+  uint32_t text_address = get_word(&data[0x18]);
+  uint32_t text_size = get_word(&data[0x1c]);
+
+  if (text_size > size - 0x800) {
+    text_size = uint32_t(size - 0x800);
+  }
+
+  for (uint32_t i = 0; i < text_size; i++) {
+    memory->write_byte(map_address(text_address + i), data[0x800 + i]);
+  }
+
+  start_exe(data.data(), regs.gp[29]);
+
+  return true;
+}
+
+
+void cpu_t::start_exe(const uint8_t *header, uint32_t stack) {
+  uint32_t bss_address = get_word(&header[0x28]);
+  uint32_t bss_size = get_word(&header[0x2c]);
+  uint32_t stack_address = get_word(&header[0x30]);
+  uint32_t stack_size = get_word(&header[0x34]);
+
+  for (uint32_t i = 0; i < bss_size; i++) {
+    memory->write_byte(map_address(bss_address + i), 0);
+  }
+
+  flush_icache();
+
+  if (stack_address != 0) {
+    stack = stack_address + stack_size;
+  }
+
+  regs.gp[28] = get_word(&header[0x14]);
+  regs.gp[29] = stack;
+  regs.gp[30] = stack;
+
+  regs.pc = get_word(&header[0x10]);
+  regs.next_pc = regs.pc + 4;
+
+  is_branch = false;
+  is_load = false;
+}
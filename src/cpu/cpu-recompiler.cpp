@@ -0,0 +1,577 @@
+#include "cpu/cpu.hpp"
+
+#include <cstring>
+#include "utility.hpp"
+
+#ifdef PSXACT_RECOMPILER
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+
+// --============--
+//   Recompiler
+// --============--
+//
+// Blocks from the cached interpreter are translated to x86-64. Instructions
+// that can't raise an exception and only touch the register file are emitted
+// natively, everything else (loads, stores, branches, coprocessors, and any
+// instruction that traps) calls back into the interpreter through
+// `native_step'. Native code never updates the program counter; it is synced
+// from the block's entry address right before the interpreter needs it and
+// when the block exits.
+//
+// The load delay slot is resolved at compile time: a native instruction that
+// directly follows a load reads the old value of the load's target register
+// from `load_value', exactly like `get_register' does.
+
+
+static const uint32_t native_cache_size = mib(32);
+
+
+int cpu_t::native_step(cpu_t *cpu, const op_t *op, uint32_t sync_offset) {
+  auto &regs = cpu->regs;
+
+  if (sync_offset != 0xffffffff) {
+    regs.pc = cpu->native_block_pc + sync_offset;
+    regs.next_pc = regs.pc + 4;
+  }
+
+  regs.this_pc = regs.pc;
+  regs.pc = regs.next_pc;
+  regs.next_pc += 4;
+
+  cpu->step(op);
+
+  return
+    regs.pc != regs.this_pc + 4 ||
+    cpu->native_block->valid == false ||
+    cpu->is_interrupt_pending();
+}
+
+
+#ifdef PSXACT_RECOMPILER
+
+
+class emitter_t {
+
+  uint8_t *buffer;
+  uint32_t size;
+  uint32_t used;
+
+public:
+
+  enum reg_t {
+    eax = 0,
+    ecx = 1,
+    edx = 2,
+    ebx = 3
+  };
+
+  emitter_t(uint8_t *buffer, uint32_t size)
+    : buffer(buffer)
+    , size(size)
+    , used(0) {
+  }
+
+  bool overflow() const {
+    return used > size;
+  }
+
+  uint32_t length() const {
+    return used;
+  }
+
+  void byte(uint8_t value) {
+    if (used < size) {
+      buffer[used] = value;
+    }
+
+    used++;
+  }
+
+  void dword(uint32_t value) {
+    byte(uint8_t(value >>  0));
+    byte(uint8_t(value >>  8));
+    byte(uint8_t(value >> 16));
+    byte(uint8_t(value >> 24));
+  }
+
+  void qword(uint64_t value) {
+    dword(uint32_t(value >>  0));
+    dword(uint32_t(value >> 32));
+  }
+
+  // all state lives in cpu_t, addressed through rbx.
+
+  void modrm_rbx(int reg, int32_t disp) {
+    byte(0x80 | (reg << 3) | ebx);
+    dword(uint32_t(disp));
+  }
+
+  void load(reg_t reg, int32_t disp) {
+    byte(0x8b);
+    modrm_rbx(reg, disp);
+  }
+
+  void store(int32_t disp, reg_t reg) {
+    byte(0x89);
+    modrm_rbx(reg, disp);
+  }
+
+  void store_imm(int32_t disp, uint32_t value) {
+    byte(0xc7);
+    modrm_rbx(0, disp);
+    dword(value);
+  }
+
+  void store_byte_imm(int32_t disp, uint8_t value) {
+    byte(0xc6);
+    modrm_rbx(0, disp);
+    byte(value);
+  }
+
+  void mov_imm(reg_t reg, uint32_t value) {
+    byte(0xb8 + reg);
+    dword(value);
+  }
+
+  void clear(reg_t reg) {
+    byte(0x31);
+    byte(0xc0 | (reg << 3) | reg);
+  }
+
+  // <op> eax, ecx
+
+  void alu(uint8_t opcode) {
+    byte(opcode);
+    byte(0xc8);
+  }
+
+  // <op> eax, imm32
+
+  void alu_imm(uint8_t opcode, uint32_t value) {
+    byte(opcode);
+    dword(value);
+  }
+
+  void not_eax() {
+    byte(0xf7);
+    byte(0xd0);
+  }
+
+  void shift_imm(int ext, uint8_t amount) {
+    byte(0xc1);
+    byte(0xc0 | (ext << 3));
+    byte(amount);
+  }
+
+  void shift_cl(int ext) {
+    byte(0xd3);
+    byte(0xc0 | (ext << 3));
+  }
+
+  // set eax to 0 or 1 from the flags
+
+  void set_eax(uint8_t condition) {
+    byte(0x0f);
+    byte(condition);
+    byte(0xc0);
+    byte(0x0f);
+    byte(0xb6);
+    byte(0xc0);
+  }
+
+  void prologue() {
+    byte(0x53);                         // push rbx
+#ifdef _WIN32
+    byte(0x48); byte(0x89); byte(0xcb); // mov rbx, rcx
+#else
+    byte(0x48); byte(0x89); byte(0xfb); // mov rbx, rdi
+#endif
+    byte(0x48); byte(0x83); byte(0xec); byte(0x20); // sub rsp, 32
+  }
+
+  void epilogue(uint32_t count) {
+    mov_imm(eax, count);
+    byte(0x48); byte(0x83); byte(0xc4); byte(0x20); // add rsp, 32
+    byte(0x5b);                                     // pop rbx
+    byte(0xc3);                                     // ret
+  }
+
+  void call(void *function, const void *arg1, uint32_t arg2) {
+#ifdef _WIN32
+    byte(0x48); byte(0x89); byte(0xd9); // mov rcx, rbx
+    byte(0x48); byte(0xba);             // mov rdx, imm64
+    qword(uint64_t(arg1));
+    byte(0x41); byte(0xb8);             // mov r8d, imm32
+    dword(arg2);
+#else
+    byte(0x48); byte(0x89); byte(0xdf); // mov rdi, rbx
+    byte(0x48); byte(0xbe);             // mov rsi, imm64
+    qword(uint64_t(arg1));
+    byte(0xba);                         // mov edx, imm32
+    dword(arg2);
+#endif
+    byte(0x48); byte(0xb8);             // mov rax, imm64
+    qword(uint64_t(function));
+    byte(0xff); byte(0xd0);             // call rax
+  }
+
+  // leaves the block with `count' if eax is non-zero.
+
+  void exit_if_eax(uint32_t count) {
+    byte(0x85); byte(0xc0); // test eax, eax
+    byte(0x74);             // jz past the epilogue
+    byte(11);
+    epilogue(count);
+  }
+};
+
+
+static int32_t offset_of(const cpu_t *cpu, const void *field) {
+  return int32_t((const uint8_t *)field - (const uint8_t *)cpu);
+}
+
+
+static bool is_load_code(uint32_t code) {
+  switch (code >> 26) {
+    case 0x20: // lb
+    case 0x21: // lh
+    case 0x22: // lwl
+    case 0x23: // lw
+    case 0x24: // lbu
+    case 0x25: // lhu
+    case 0x26: // lwr
+      return true;
+  }
+
+  return false;
+}
+
+
+static bool is_native_code(uint32_t code) {
+  switch (code >> 26) {
+    case 0x00:
+      switch (code & 0x3f) {
+        case 0x00: case 0x02: case 0x03: // sll, srl, sra
+        case 0x04: case 0x06: case 0x07: // sllv, srlv, srav
+        case 0x10: case 0x11: case 0x12: case 0x13: // mfhi, mthi, mflo, mtlo
+        case 0x18: case 0x19: // mult, multu
+        case 0x21: case 0x23: // addu, subu
+        case 0x24: case 0x25: case 0x26: case 0x27: // and, or, xor, nor
+        case 0x2a: case 0x2b: // slt, sltu
+          return true;
+      }
+      return false;
+
+    case 0x09: // addiu
+    case 0x0a: // slti
+    case 0x0b: // sltiu
+    case 0x0c: // andi
+    case 0x0d: // ori
+    case 0x0e: // xori
+    case 0x0f: // lui
+      return true;
+  }
+
+  return false;
+}
+
+
+void *cpu_t::compile_native(block_t *block) {
+  if (native_cache == nullptr) {
+#ifdef _WIN32
+    native_cache = (uint8_t *)VirtualAlloc(nullptr, native_cache_size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+    void *memory = mmap(nullptr, native_cache_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    native_cache = (memory == MAP_FAILED) ? nullptr : (uint8_t *)memory;
+#endif
+
+    if (native_cache == nullptr) {
+      printf("[cpu] unable to allocate executable memory, using the cached interpreter\n");
+      mode = cpu_mode_t::cached_interpreter;
+      return nullptr;
+    }
+  }
+
+  int32_t gp = offset_of(this, &regs.gp[0]);
+  int32_t lo = offset_of(this, &regs.lo);
+  int32_t hi = offset_of(this, &regs.hi);
+  int32_t pc = offset_of(this, &regs.pc);
+  int32_t this_pc = offset_of(this, &regs.this_pc);
+  int32_t next_pc = offset_of(this, &regs.next_pc);
+  int32_t block_pc = offset_of(this, &native_block_pc);
+  int32_t branch = offset_of(this, &is_branch);
+  int32_t load = offset_of(this, &is_load);
+  int32_t value = offset_of(this, &load_value);
+
+  emitter_t e(native_cache + native_cache_used, native_cache_size - native_cache_used);
+  e.prologue();
+
+  // what the previous instruction left behind
+
+  bool prev_native = true;
+  bool prev_branch = false;
+  int prev_load = -1;
+
+  // reads a register, honouring the load delay slot of the previous
+  // instruction.
+
+  auto read = [&](emitter_t::reg_t reg, int r) {
+    if (r == 0) {
+      e.clear(reg);
+    }
+    else if (r == prev_load) {
+      e.load(reg, value);
+    }
+    else {
+      e.load(reg, gp + (r * 4));
+    }
+  };
+
+  auto write = [&](int r) {
+    if (r != 0) {
+      e.store(gp + (r * 4), emitter_t::eax);
+    }
+  };
+
+  uint32_t count = uint32_t(block->ops.size());
+
+  for (uint32_t i = 0; i < count; i++) {
+    const op_t &op = block->ops[i];
+
+    if (is_native_code(op.code) == false) {
+      e.call((void *)&cpu_t::native_step, &op, prev_native && i != 0 ? (i * 4) : 0xffffffff);
+      e.exit_if_eax(i + 1);
+
+      prev_native = false;
+      prev_branch = is_branch_code(op.code);
+      prev_load = is_load_code(op.code) ? op.rt : -1;
+      continue;
+    }
+
+    // the interpreter clears these at the start of every instruction
+
+    if (prev_branch) {
+      e.store_byte_imm(branch, 0);
+    }
+
+    if (prev_load != -1) {
+      e.store_byte_imm(load, 0);
+    }
+
+    switch (op.code >> 26) {
+      case 0x00:
+        switch (op.code & 0x3f) {
+          case 0x00: // sll
+          case 0x02: // srl
+          case 0x03: // sra
+            if (op.rd == 0) break;
+            read(emitter_t::eax, op.rt);
+            if (op.sa) {
+              e.shift_imm((op.code & 0x3f) == 0x00 ? 4 : (op.code & 0x3f) == 0x02 ? 5 : 7, op.sa);
+            }
+            write(op.rd);
+            break;
+
+          case 0x04: // sllv
+          case 0x06: // srlv
+          case 0x07: // srav
+            if (op.rd == 0) break;
+            read(emitter_t::ecx, op.rs);
+            read(emitter_t::eax, op.rt);
+            e.shift_cl((op.code & 0x3f) == 0x04 ? 4 : (op.code & 0x3f) == 0x06 ? 5 : 7);
+            write(op.rd);
+            break;
+
+          case 0x10: // mfhi
+            if (op.rd == 0) break;
+            e.load(emitter_t::eax, hi);
+            write(op.rd);
+            break;
+
+          case 0x11: // mthi
+            read(emitter_t::eax, op.rs);
+            e.store(hi, emitter_t::eax);
+            break;
+
+          case 0x12: // mflo
+            if (op.rd == 0) break;
+            e.load(emitter_t::eax, lo);
+            write(op.rd);
+            break;
+
+          case 0x13: // mtlo
+            read(emitter_t::eax, op.rs);
+            e.store(lo, emitter_t::eax);
+            break;
+
+          case 0x18: // mult
+          case 0x19: // multu
+            read(emitter_t::eax, op.rs);
+            read(emitter_t::ecx, op.rt);
+            e.byte(0xf7);
+            e.byte((op.code & 1) ? 0xe1 : 0xe9); // mul ecx / imul ecx
+            e.store(lo, emitter_t::eax);
+            e.store(hi, emitter_t::edx);
+            break;
+
+          case 0x21: // addu
+          case 0x23: // subu
+          case 0x24: // and
+          case 0x25: // or
+          case 0x26: // xor
+          case 0x27: // nor
+            if (op.rd == 0) break;
+            read(emitter_t::eax, op.rs);
+            read(emitter_t::ecx, op.rt);
+
+            switch (op.code & 0x3f) {
+              case 0x21: e.alu(0x01); break;
+              case 0x23: e.alu(0x29); break;
+              case 0x24: e.alu(0x21); break;
+              case 0x25: e.alu(0x09); break;
+              case 0x26: e.alu(0x31); break;
+              case 0x27: e.alu(0x09); e.not_eax(); break;
+            }
+
+            write(op.rd);
+            break;
+
+          case 0x2a: // slt
+          case 0x2b: // sltu
+            if (op.rd == 0) break;
+            read(emitter_t::eax, op.rs);
+            read(emitter_t::ecx, op.rt);
+            e.alu(0x39); // cmp eax, ecx
+            e.set_eax((op.code & 1) ? 0x92 : 0x9c); // setb / setl
+            write(op.rd);
+            break;
+        }
+        break;
+
+      case 0x09: // addiu
+        if (op.rt == 0) break;
+        read(emitter_t::eax, op.rs);
+        e.alu_imm(0x05, op.iconst);
+        write(op.rt);
+        break;
+
+      case 0x0a: // slti
+      case 0x0b: // sltiu
+        if (op.rt == 0) break;
+        read(emitter_t::eax, op.rs);
+        e.alu_imm(0x3d, op.iconst); // cmp eax, imm32
+        e.set_eax((op.code >> 26) == 0x0b ? 0x92 : 0x9c);
+        write(op.rt);
+        break;
+
+      case 0x0c: // andi
+      case 0x0d: // ori
+      case 0x0e: // xori
+        if (op.rt == 0) break;
+        read(emitter_t::eax, op.rs);
+
+        switch (op.code >> 26) {
+          case 0x0c: e.alu_imm(0x25, utility::uclip<16>(op.iconst)); break;
+          case 0x0d: e.alu_imm(0x0d, utility::uclip<16>(op.iconst)); break;
+          case 0x0e: e.alu_imm(0x35, utility::uclip<16>(op.iconst)); break;
+        }
+
+        write(op.rt);
+        break;
+
+      case 0x0f: // lui
+        if (op.rt == 0) break;
+        e.store_imm(gp + (op.rt * 4), utility::uclip<16>(op.iconst) << 16);
+        break;
+    }
+
+    // when the block ends on a native instruction, leave the program counter
+    // the way the interpreter would have.
+
+    if (i == count - 1) {
+      if (prev_branch) {
+        e.load(emitter_t::eax, next_pc);
+      }
+      else {
+        e.load(emitter_t::eax, block_pc);
+        e.alu_imm(0x05, (i + 1) * 4);
+      }
+
+      e.store(pc, emitter_t::eax);
+      e.alu_imm(0x05, 4);
+      e.store(next_pc, emitter_t::eax);
+
+      e.load(emitter_t::eax, block_pc);
+      e.alu_imm(0x05, i * 4);
+      e.store(this_pc, emitter_t::eax);
+    }
+
+    prev_native = true;
+    prev_branch = false;
+    prev_load = -1;
+  }
+
+  e.epilogue(count);
+
+  if (e.overflow()) {
+    flush_native();
+    return nullptr;
+  }
+
+  void *result = native_cache + native_cache_used;
+  native_cache_used += (e.length() + 15) & ~15;
+
+  return result;
+}
+
+
+#else
+
+
+void *cpu_t::compile_native(block_t *block) {
+  return nullptr;
+}
+
+
+#endif
+
+
+int cpu_t::run_native(block_t *block) {
+  if (block->native == nullptr) {
+    block->native = compile_native(block);
+
+    if (block->native == nullptr) {
+      return run_block(block);
+    }
+  }
+
+  typedef int (*native_t)(cpu_t *cpu);
+
+  native_block = block;
+  native_block_pc = regs.pc;
+
+  return ((native_t)block->native)(this);
+}
+
+
+void cpu_t::flush_native() {
+  for (auto block : wram_blocks) {
+    if (block) {
+      block->native = nullptr;
+    }
+  }
+
+  for (auto block : bios_blocks) {
+    if (block) {
+      block->native = nullptr;
+    }
+  }
+
+  native_cache_used = 0;
+}
@@ -1,5 +1,7 @@
 #include "cpu/cpu.hpp"
 
+#include <cstring>
+#include "cpu/bios-hle.hpp"
 #include "cpu/cpu-cop0.hpp"
 #include "cpu/cpu-cop2.hpp"
 #include "utility.hpp"
@@ -21,7 +23,7 @@ cpu_t::opcode_t cpu_t::op_table[64] = {
   &cpu_t::op_lwc0, &cpu_t::op_lwc1,  &cpu_t::op_lwc2, &cpu_t::op_lwc3,
   &cpu_t::op_und,  &cpu_t::op_und,   &cpu_t::op_und,  &cpu_t::op_und,
   &cpu_t::op_swc0, &cpu_t::op_swc1,  &cpu_t::op_swc2, &cpu_t::op_swc3,
-  &cpu_t::op_und,  &cpu_t::op_und,   &cpu_t::op_und,  &cpu_t::op_und
+  &cpu_t::op_und,  &cpu_t::op_und,   &cpu_t::op_und,  &cpu_t::op_hle
 };
 
 
@@ -58,6 +60,21 @@ cpu_t::cpu_t(memory_access_t *memory)
   cop[2] = new cpu_cop2_t();
 
   cop[0]->write_gpr(12, 0x00000000);
+
+  op = &decoded;
+  hle = nullptr;
+  mode = cpu_mode_t::interpreter;
+  idle = false;
+
+  native_cache = nullptr;
+  native_cache_used = 0;
+
+  cache_control = 0;
+
+  flush_icache();
+
+  memset(wram_blocks, 0, sizeof(wram_blocks));
+  memset(bios_blocks, 0, sizeof(bios_blocks));
 }
 
 
@@ -81,8 +98,107 @@ bool cpu_t::get_cop_usable(int n) {
 }
 
 
-void cpu_t::tick() {
+void cpu_t::enable_hle(const char *game_file_name, const char *exe_file_name) {
+  delete hle;
+  hle = new bios_hle_t(this, memory, game_file_name, exe_file_name);
+}
+
+
+uint32_t cpu_t::get_pc() {
+  return regs.pc;
+}
+
+
+cpu_mode_t cpu_t::get_mode() {
+  return mode;
+}
+
+
+void cpu_t::set_mode(cpu_mode_t mode) {
+  flush_blocks();
+
+#ifndef PSXACT_RECOMPILER
+  if (mode == cpu_mode_t::recompiler) {
+    printf("[cpu] recompiler not available on this host, using the cached interpreter\n");
+    mode = cpu_mode_t::cached_interpreter;
+  }
+#endif
+
+  this->mode = mode;
+}
+
+
+void cpu_t::serialize(state_t &state) {
+  state.io(regs);
+  state.io(code);
+  state.io(is_branch);
+  state.io(is_branch_delay_slot);
+  state.io(is_load);
+  state.io(is_load_delay_slot);
+  state.io(load_index);
+  state.io(load_value);
+  state.io(istat);
+  state.io(imask);
+  state.io(cache_control);
+  state.io(icache_tag);
+  state.io(icache_data);
+
+  get_cop(0)->serialize(state);
+  get_cop(2)->serialize(state);
+
+  if (state.is_loading()) {
+    flush_blocks();
+
+    op = &decoded;
+    idle = false;
+  }
+}
+
+
+int cpu_t::tick() {
+  uint32_t pc = regs.pc;
+  int count;
+
+  idle = false;
+
+  if (mode == cpu_mode_t::recompiler) {
+    // native code assumes it starts outside of any delay slot and with no
+    // interrupt to take, everything else goes through the interpreter.
+
+    if (is_branch == false && is_load == false && is_interrupt_pending() == false) {
+      if (block_t *block = get_block(regs.pc)) {
+        count = run_native(block);
+        idle = block->idle && regs.pc == pc && is_idle_safe(block);
+
+        return count;
+      }
+    }
+  }
+  else if (mode == cpu_mode_t::cached_interpreter) {
+    if (block_t *block = get_block(regs.pc)) {
+      count = run_block(block);
+      idle = block->idle && regs.pc == pc && is_idle_safe(block);
+
+      return count;
+    }
+  }
+
   read_code();
+  decode(decoded, code);
+  step(&decoded);
+
+  return 1;
+}
+
+
+bool cpu_t::is_idle() {
+  return idle;
+}
+
+
+void cpu_t::step(const op_t *op) {
+  this->op = op;
+  this->code = op->code;
 
   is_branch_delay_slot = is_branch;
   is_branch = false;
@@ -90,22 +206,23 @@ void cpu_t::tick() {
   is_load_delay_slot = is_load;
   is_load = false;
 
-  bool iec = (get_cop(0)->read_gpr(12) & 1) != 0;
-  bool irq = (get_cop(0)->read_gpr(12) & get_cop(0)->read_gpr(13) & 0xff00) != 0;
-
-  if (iec && irq) {
+  if (is_interrupt_pending()) {
     enter_exception(cop0_exception_code_t::interrupt);
   }
   else {
-    uint32_t code = (this->code >> 26) & 63;
-    if (code)
-      (*this.*op_table[code])();
-    else
-      (*this.*op_table_special[this->code & 63])();
+    (*this.*op->handler)();
   }
 }
 
 
+bool cpu_t::is_interrupt_pending() {
+  bool iec = (get_cop(0)->read_gpr(12) & 1) != 0;
+  bool irq = (get_cop(0)->read_gpr(12) & get_cop(0)->read_gpr(13) & 0xff00) != 0;
+
+  return iec && irq;
+}
+
+
 static uint32_t segments[8] = {
   0x7fffffff, // kuseg ($0000_0000 - $7fff_ffff)
   0x7fffffff, //
@@ -118,7 +235,7 @@ static uint32_t segments[8] = {
 };
 
 
-static inline uint32_t map_address(uint32_t address) {
+uint32_t cpu_t::map_address(uint32_t address) {
   return address & segments[address >> 29];
 }
 
@@ -179,13 +296,97 @@ void cpu_t::read_code() {
   regs.pc = regs.next_pc;
   regs.next_pc += 4;
 
-  // todo: read i-cache
+  if (is_code_cached(regs.this_pc)) {
+    uint32_t index = (regs.this_pc >> 2) & 0x3ff;
+
+    if (icache_tag[index] != (regs.this_pc & 0xfffff000)) {
+      fill_icache(regs.this_pc);
+    }
+
+    code = icache_data[index];
+    return;
+  }
 
   code = memory->read_word(map_address(regs.this_pc));
 }
 
 
+bool cpu_t::is_code_cached(uint32_t address) {
+  // kseg1 and kseg2 are never cached
+
+  return (cache_control & (1 << 11)) && address < 0xa0000000;
+}
+
+
+void cpu_t::fill_icache(uint32_t address) {
+  // a miss refills the line from the missing word up to its end
+
+  uint32_t tag = address & 0xfffff000;
+  uint32_t index = (address >> 2) & 0x3ff;
+
+  for (; index <= (((address >> 2) & 0x3ff) | 3); index++, address += 4) {
+    icache_tag[index] = tag;
+    icache_data[index] = memory->read_word(map_address(address));
+  }
+}
+
+
+void cpu_t::flush_icache() {
+  for (auto &tag : icache_tag) {
+    tag = icache_invalid;
+  }
+}
+
+
+void cpu_t::write_cache_control(uint32_t data) {
+  // system.write(2, 0xfffe0130, 0x00000804)
+  // system.write(2, 0xfffe0130, 0x00000800)
+  // system.write(2, 0xfffe0130, 0x0001e988)
+
+  //     17 :: nostr  - No Streaming
+  //     16 :: ldsch  - Enable Load Scheduling
+  //     15 :: bgnt   - Enable Bus Grant
+  //     14 :: nopad  - No Wait State
+  //     13 :: rdpri  - Enable Read Priority
+  //     12 :: intp   - Interrupt Polarity
+  //     11 :: is1    - Enable I-Cache Set 1
+  //     10 :: is0    - Enable I-Cache Set 0
+  //  9,  8 :: iblksz - I-Cache Refill Size
+  //      7 :: ds     - Enable D-Cache
+  //  5,  4 :: dblksz - D-Cache Refill Size
+  //      3 :: ram    - Scratchpad RAM
+  //      2 :: tag    - Tag Test Mode
+  //      1 :: inv    - Invalidate Mode
+  //      0 :: lock   - Lock Mode
+
+  cache_control = data;
+}
+
+
+void cpu_t::write_icache(uint32_t address, uint32_t data) {
+  uint32_t index = (address >> 2) & 0x3ff;
+
+  if (cache_control & (1 << 2)) {
+    // tag test mode, the bios uses this to invalidate whole lines
+
+    index &= ~3;
+
+    icache_tag[index | 0] = icache_invalid;
+    icache_tag[index | 1] = icache_invalid;
+    icache_tag[index | 2] = icache_invalid;
+    icache_tag[index | 3] = icache_invalid;
+  }
+  else {
+    icache_data[index] = data;
+  }
+}
+
+
 uint32_t cpu_t::read_data_byte(uint32_t address) {
+  if (address == 0xfffe0130) {
+    return cache_control;
+  }
+
   if (get_cop(0)->read_gpr(12) & (1 << 16)) {
     return 0; // isc=1
   }
@@ -196,6 +397,10 @@ uint32_t cpu_t::read_data_byte(uint32_t address) {
 
 
 uint32_t cpu_t::read_data_half(uint32_t address) {
+  if (address == 0xfffe0130) {
+    return cache_control;
+  }
+
   if (get_cop(0)->read_gpr(12) & (1 << 16)) {
     return 0; // isc=1
   }
@@ -206,6 +411,10 @@ uint32_t cpu_t::read_data_half(uint32_t address) {
 
 
 uint32_t cpu_t::read_data_word(uint32_t address) {
+  if (address == 0xfffe0130) {
+    return cache_control;
+  }
+
   if (get_cop(0)->read_gpr(12) & (1 << 16)) {
     return 0; // isc=1
   }
@@ -216,8 +425,12 @@ uint32_t cpu_t::read_data_word(uint32_t address) {
 
 
 void cpu_t::write_data_byte(uint32_t address, uint32_t data) {
+  if (address == 0xfffe0130) {
+    return write_cache_control(data);
+  }
+
   if (get_cop(0)->read_gpr(12) & (1 << 16)) {
-    return; // isc=1
+    return write_icache(address, data); // isc=1
   }
 
   // TODO: write cache?
@@ -226,8 +439,12 @@ void cpu_t::write_data_byte(uint32_t address, uint32_t data) {
 
 
 void cpu_t::write_data_half(uint32_t address, uint32_t data) {
+  if (address == 0xfffe0130) {
+    return write_cache_control(data);
+  }
+
   if (get_cop(0)->read_gpr(12) & (1 << 16)) {
-    return; // isc=1
+    return write_icache(address, data); // isc=1
   }
 
   // TODO: write cache?
@@ -236,8 +453,12 @@ void cpu_t::write_data_half(uint32_t address, uint32_t data) {
 
 
 void cpu_t::write_data_word(uint32_t address, uint32_t data) {
+  if (address == 0xfffe0130) {
+    return write_cache_control(data);
+  }
+
   if (get_cop(0)->read_gpr(12) & (1 << 16)) {
-    return; // isc=1
+    return write_icache(address, data); // isc=1
   }
 
   // TODO: write cache?
@@ -3,6 +3,7 @@
 
 
 #include <cstdio>
+#include <vector>
 #include "cpu/bios-call-decoder.hpp"
 #include "cpu/cpu-cop.hpp"
 #include "cpu/cpu-cop0.hpp"
@@ -10,12 +11,33 @@
 #include "console.hpp"
 #include "memory-access.hpp"
 #include "memory-component.hpp"
+#include "memory.hpp"
+#include "state.hpp"
+
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PSXACT_RECOMPILER
+#endif
+
+
+class bios_hle_t;
+
+
+enum class cpu_mode_t {
+  interpreter,
+  cached_interpreter,
+  recompiler
+};
 
 
 class cpu_t : public memory_component_t {
 
+  friend class bios_hle_t;
+
   bios_call_decoder_t bios_call_decoder;
 
+  bios_hle_t *hle;
+
   memory_access_t *memory;
 
   cpu_cop_t *cop[4];
@@ -44,27 +66,101 @@ class cpu_t : public memory_component_t {
   uint32_t istat;
   uint32_t imask;
 
+  // instruction cache, 4 KiB direct mapped with 16-byte lines. every word
+  // keeps its own tag, and an invalid word has a tag that can't match any
+  // fetch address.
+
+  static const uint32_t icache_invalid = 0xffffffff;
+
+  uint32_t cache_control;
+  uint32_t icache_tag[kib(4) / 4];
+  uint32_t icache_data[kib(4) / 4];
+
   typedef void (cpu_t:: *opcode_t)();
 
   static opcode_t op_table[64];
 
   static opcode_t op_table_special[64];
 
+  // predecoded instruction, the fields are extracted once so that handlers
+  // don't have to pick them out of `code' every time they run.
+
+  struct op_t {
+    opcode_t handler;
+    uint32_t code;
+    uint32_t iconst;
+    uint8_t rs;
+    uint8_t rt;
+    uint8_t rd;
+    uint8_t sa;
+  };
+
+  op_t decoded;
+  const op_t *op;
+
+  // cached interpreter
+
+  static const int block_max_length = 64;
+
+  struct block_t {
+    uint32_t address;
+    uint32_t first_page;
+    uint32_t last_page;
+    bool valid;
+    bool idle;
+    std::vector<op_t> ops;
+    void *native;
+  };
+
+  cpu_mode_t mode;
+
+  block_t *wram_blocks[mib(2) / 4];
+  block_t *bios_blocks[kib(512) / 4];
+  std::vector<block_t *> wram_pages[mib(2) / kib(4)];
+  std::vector<block_t *> retired_blocks;
+
+  bool idle;
+
+  // recompiler
+
+  uint8_t *native_cache;
+  uint32_t native_cache_used;
+  block_t *native_block;
+  uint32_t native_block_pc;
+
 public:
 
   cpu_t(memory_access_t *memory);
 
   cpu_cop_t *get_cop(int n);
 
+  void enable_hle(const char *game_file_name, const char *exe_file_name);
+
+  uint32_t get_pc();
+
+  bool load_exe(const char *file_name);
+
+  void start_exe(const uint8_t *header, uint32_t stack);
+
   bool get_cop_usable(int n);
 
+  cpu_mode_t get_mode();
+
+  void set_mode(cpu_mode_t mode);
+
+  void serialize(state_t &state);
+
   void disassemble(FILE *file);
 
   void disassemble_special(FILE *file);
 
   void disassemble_reg_imm(FILE *file);
 
-  void tick();
+  int tick();
+
+  bool is_idle();
+
+  void step(const op_t *op);
 
   void enter_exception(cop0_exception_code_t code);
 
@@ -72,8 +168,60 @@ public:
 
   void update_irq(uint32_t stat, uint32_t mask);
 
+  static void decode(op_t &op, uint32_t code);
+
+  static uint32_t map_address(uint32_t address);
+
+  static bool is_branch_code(uint32_t code);
+
+  // -=================-
+  //  Cached interpreter
+  // -=================-
+
+  block_t **get_block_slot(uint32_t address);
+
+  block_t *get_block(uint32_t address);
+
+  block_t *compile_block(uint32_t address);
+
+  void watch_page(uint32_t page, block_t *block);
+
+  int run_block(block_t *block);
+
+  void invalidate_code(uint32_t address);
+
+  void flush_blocks();
+
+  static bool is_idle_loop(const block_t *block);
+
+  bool is_idle_safe(const block_t *block);
+
+  // -==========-
+  //  Recompiler
+  // -==========-
+
+  bool is_interrupt_pending();
+
+  int run_native(block_t *block);
+
+  void *compile_native(block_t *block);
+
+  void flush_native();
+
+  static int native_step(cpu_t *cpu, const op_t *op, uint32_t sync_offset);
+
   void read_code();
 
+  bool is_code_cached(uint32_t address);
+
+  void fill_icache(uint32_t address);
+
+  void flush_icache();
+
+  void write_cache_control(uint32_t data);
+
+  void write_icache(uint32_t address, uint32_t data);
+
   uint32_t read_data_byte(uint32_t address);
 
   uint32_t read_data_half(uint32_t address);
@@ -250,6 +398,10 @@ public:
 
   void op_und();
 
+  // kernel trap, only defined when the BIOS is emulated
+
+  void op_hle();
+
   uint32_t decode_iconst();
 
   uint32_t decode_uconst();
@@ -3,31 +3,46 @@
 #include "utility.hpp"
 
 
+void cpu_t::decode(op_t &op, uint32_t code) {
+  op.handler = (code >> 26)
+    ? op_table[code >> 26]
+    : op_table_special[code & 63]
+    ;
+
+  op.code = code;
+  op.iconst = utility::sclip<16>(code);
+  op.rs = uint8_t(utility::uclip<5>(code >> 21));
+  op.rt = uint8_t(utility::uclip<5>(code >> 16));
+  op.rd = uint8_t(utility::uclip<5>(code >> 11));
+  op.sa = uint8_t(utility::uclip<5>(code >> 6));
+}
+
+
 uint32_t cpu_t::decode_iconst() {
-  return utility::sclip<16>(code);
+  return op->iconst;
 }
 
 
 uint32_t cpu_t::decode_uconst() {
-  return utility::uclip<16>(code);
+  return utility::uclip<16>(op->iconst);
 }
 
 
 uint32_t cpu_t::decode_sa() {
-  return utility::uclip<5>(code >> 6);
+  return op->sa;
 }
 
 
 uint32_t cpu_t::decode_rd() {
-  return utility::uclip<5>(code >> 11);
+  return op->rd;
 }
 
 
 uint32_t cpu_t::decode_rt() {
-  return utility::uclip<5>(code >> 16);
+  return op->rt;
 }
 
 
 uint32_t cpu_t::decode_rs() {
-  return utility::uclip<5>(code >> 21);
+  return op->rs;
 }
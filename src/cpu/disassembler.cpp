@@ -165,6 +165,8 @@ void cpu_t::disassemble(FILE *file) {
 
   case 0x2e: fprintf(file, "swr       %s, 0x%04x(%s)\n", get_rt(), get_iconst(), get_rs()); break;
 
+  case 0x3f: fprintf(file, "hle       0x%02x\n", code & 0x3ffffff); break;
+
   default:
     fprintf(file, "unknown (0x%08x)\n", code);
     break;
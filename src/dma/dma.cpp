@@ -1,12 +1,22 @@
 #include "dma/dma.hpp"
 
+#include <algorithm>
+#include "gpu/gpu.hpp"
 #include "utility.hpp"
 
 
-dma_t::dma_t(interrupt_access_t *irq, memory_access_t *memory)
+dma_t::dma_t(interrupt_access_t *irq, memory_access_t *memory, gpu_t *gpu)
   : memory_component_t("dma")
   , irq(irq)
-  , memory(memory) {
+  , memory(memory)
+  , gpu(gpu) {
+}
+
+
+void dma_t::serialize(state_t &state) {
+  state.io(dpcr);
+  state.io(dicr);
+  state.io(channels);
 }
 
 
@@ -96,6 +106,12 @@ void dma_t::run_channel_1() {
 }
 
 
+// channel 2 hands the GPU whole bursts, so a texture upload can go into
+// VRAM a row at a time.
+
+static const uint32_t BURST_SIZE = 256;
+
+
 void dma_t::run_channel_2_data_read() {
   uint32_t address = channels[2].address;
   uint32_t bs = (channels[2].counter >> 0) & 0xffff;
@@ -104,11 +120,18 @@ void dma_t::run_channel_2_data_read() {
   bs = bs ? bs : 0x10000;
   ba = ba ? ba : 0x10000;
 
+  uint32_t buffer[BURST_SIZE];
+
   for (uint32_t a = 0; a < ba; a++) {
-    for (uint32_t s = 0; s < bs; s++) {
-      uint32_t data = memory->read_word(0x1f801810);
-      memory->write_word(address, data);
-      address += 4;
+    for (uint32_t s = 0; s < bs; s += BURST_SIZE) {
+      uint32_t count = std::min(BURST_SIZE, bs - s);
+
+      gpu->io_read_words(GPU_READ, buffer, count);
+
+      for (uint32_t i = 0; i < count; i++) {
+        memory->write_word(address, buffer[i]);
+        address += 4;
+      }
     }
   }
 
@@ -126,11 +149,18 @@ void dma_t::run_channel_2_data_write() {
   bs = bs ? bs : 0x10000;
   ba = ba ? ba : 0x10000;
 
+  uint32_t buffer[BURST_SIZE];
+
   for (uint32_t a = 0; a < ba; a++) {
-    for (uint32_t s = 0; s < bs; s++) {
-      uint32_t data = memory->read_word(address);
-      memory->write_word(0x1f801810, data);
-      address += 4;
+    for (uint32_t s = 0; s < bs; s += BURST_SIZE) {
+      uint32_t count = std::min(BURST_SIZE, bs - s);
+
+      for (uint32_t i = 0; i < count; i++) {
+        buffer[i] = memory->read_word(address);
+        address += 4;
+      }
+
+      gpu->io_write_words(GPU_GP0, buffer, count);
     }
   }
 
@@ -143,6 +173,8 @@ void dma_t::run_channel_2_data_write() {
 void dma_t::run_channel_2_list() {
   uint32_t address = channels[2].address & 0x1ffffc;
 
+  uint32_t buffer[BURST_SIZE];
+
   while (1) {
     uint32_t header = memory->read_word(address);
     uint32_t length = header >> 24;
@@ -150,10 +182,11 @@ void dma_t::run_channel_2_list() {
     for (uint32_t i = 0; i < length; i++) {
       address = (address + 4) & 0x1ffffc;
 
-      uint32_t data = memory->read_word(address);
-      memory->write_word(0x1f801810, data);
+      buffer[i] = memory->read_word(address);
     }
 
+    gpu->io_write_words(GPU_GP0, buffer, length);
+
     if (header & 0x800000) {
       break;
     }
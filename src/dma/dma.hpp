@@ -5,12 +5,17 @@
 #include "interrupt-access.hpp"
 #include "memory-access.hpp"
 #include "memory-component.hpp"
+#include "state.hpp"
+
+
+class gpu_t;
 
 
 class dma_t : public memory_component_t {
 
   interrupt_access_t *irq;
   memory_access_t *memory;
+  gpu_t *gpu;
 
   uint32_t dpcr = 0x07654321;
   uint32_t dicr = 0x00000000;
@@ -23,7 +28,9 @@ class dma_t : public memory_component_t {
 
 public:
 
-  dma_t(interrupt_access_t *irq, memory_access_t *memory);
+  dma_t(interrupt_access_t *irq, memory_access_t *memory, gpu_t *gpu);
+
+  void serialize(state_t &state);
 
   uint32_t io_read_word(uint32_t address);
 
@@ -0,0 +1,100 @@
+#ifndef __psxact_gpu_blend__
+#define __psxact_gpu_blend__
+
+
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+
+// Semi-transparency works on packed 15-bit pixels, five bits a channel, the
+// same as the hardware:
+//
+//   0: B/2 + F/2
+//   1: B + F
+//   2: B - F
+//   3: B + F/4
+//
+// Channels saturate, and bit 15 of the result is clear.
+
+
+template<uint32_t mode>
+inline int32_t blend_channel(int32_t b, int32_t f) {
+  switch (mode) {
+    case 0:
+      return (b + f) >> 1;
+
+    case 1:
+      return std::min(31, b + f);
+
+    case 2:
+      return std::max(0, b - f);
+
+    default:
+      return std::min(31, b + (f >> 2));
+  }
+}
+
+
+template<uint32_t mode>
+inline uint16_t blend_pixel(uint16_t bg, uint16_t fg) {
+  int32_t r = blend_channel<mode>((bg >>  0) & 31, (fg >>  0) & 31);
+  int32_t g = blend_channel<mode>((bg >>  5) & 31, (fg >>  5) & 31);
+  int32_t b = blend_channel<mode>((bg >> 10) & 31, (fg >> 10) & 31);
+
+  return uint16_t(r | (g << 5) | (b << 10));
+}
+
+
+#if defined(__SSE2__) || defined(_M_X64)
+
+
+template<uint32_t mode>
+inline __m128i blend_channels(__m128i b, __m128i f) {
+  const __m128i max = _mm_set1_epi16(31);
+
+  switch (mode) {
+    case 0:
+      return _mm_srli_epi16(_mm_add_epi16(b, f), 1);
+
+    case 1:
+      return _mm_min_epi16(_mm_add_epi16(b, f), max);
+
+    case 2:
+      return _mm_subs_epu16(b, f);
+
+    default:
+      return _mm_min_epi16(_mm_add_epi16(b, _mm_srli_epi16(f, 2)), max);
+  }
+}
+
+
+// blend_pixel, eight at a time
+
+template<uint32_t mode>
+inline __m128i blend_pixels(__m128i bg, __m128i fg) {
+  const __m128i channel = _mm_set1_epi16(31);
+
+  __m128i r = blend_channels<mode>(
+    _mm_and_si128(bg, channel),
+    _mm_and_si128(fg, channel));
+
+  __m128i g = blend_channels<mode>(
+    _mm_and_si128(_mm_srli_epi16(bg, 5), channel),
+    _mm_and_si128(_mm_srli_epi16(fg, 5), channel));
+
+  __m128i b = blend_channels<mode>(
+    _mm_and_si128(_mm_srli_epi16(bg, 10), channel),
+    _mm_and_si128(_mm_srli_epi16(fg, 10), channel));
+
+  return _mm_or_si128(r, _mm_or_si128(_mm_slli_epi16(g, 5), _mm_slli_epi16(b, 10)));
+}
+
+
+#endif
+
+
+#endif // __psxact_gpu_blend__
@@ -1,5 +1,7 @@
 #include "gpu/gpu.hpp"
 
+#include "gpu/gpu-stats.hpp"
+#include "gpu/gpu-tiles.hpp"
 #include "utility.hpp"
 
 
@@ -9,8 +11,8 @@ static int command_size[256] = {
   4, 1, 4, 1, 7, 7, 7, 7, 5, 1, 5, 1, 9, 9, 9, 9, // $20
   6, 1, 6, 1, 9, 1, 9, 1, 8, 1, 8, 1,12, 1,12, 1, // $30
 
-  3, 1, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // $40
-  4, 1, 4, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // $50
+  3, 3, 3, 3, 3, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2, // $40
+  4, 4, 4, 4, 4, 4, 4, 4, 2, 2, 2, 2, 2, 2, 2, 2, // $50
   3, 1, 3, 1, 4, 4, 4, 4, 2, 1, 2, 1, 3, 3, 3, 3, // $60
   2, 1, 2, 1, 3, 3, 3, 3, 2, 1, 2, 1, 3, 3, 3, 3, // $70
 
@@ -26,6 +28,29 @@ static int command_size[256] = {
 };
 
 
+int gpu_t::get_command_size(uint32_t command) {
+  return command_size[command & 0xff];
+}
+
+
+uint32_t gpu_t::gp0_status(uint32_t status, uint32_t command) {
+  switch (command >> 24) {
+    case 0xe1:
+      status &= ~0x87ff;
+      status |= (command << 0) & 0x7ff;
+      status |= (command << 4) & 0x8000;
+      break;
+
+    case 0xe6:
+      status &= ~0x1800;
+      status |= (command << 11) & 0x1800;
+      break;
+  }
+
+  return status;
+}
+
+
 void gpu_t::fill_rectangle() {
   uint16_t color =
       ((fifo.buffer[0] >> 3) & 0x001f) |
@@ -40,27 +65,57 @@ void gpu_t::fill_rectangle() {
   count.x = (fifo.buffer[2] + 0xf) & 0x7f0;
   count.y = (fifo.buffer[2] >> 16) & 0x1ff;
 
+  // fills ignore the drawing area and the mask settings
+
   for (int y = 0; y < count.y; y++) {
-    for (int x = 0; x < count.x; x++) {
-      vram_write(
-        point.x + x,
-        point.y + y,
-        color
-      );
-    }
+    vram_fill_row(point.x, point.y + y, color, count.x);
   }
 }
 
 
-void gpu_t::copy_vram_to_vram() {}
+void gpu_t::copy_vram_to_vram() {
+  point_t source;
+  source.x = (fifo.buffer[1] >> 0) & 0x3ff;
+  source.y = (fifo.buffer[1] >> 16) & 0x1ff;
+
+  point_t target;
+  target.x = (fifo.buffer[2] >> 0) & 0x3ff;
+  target.y = (fifo.buffer[2] >> 16) & 0x1ff;
+
+  point_t count;
+  count.x = ((fifo.buffer[3] - 1) & 0x3ff) + 1;
+  count.y = (((fifo.buffer[3] >> 16) - 1) & 0x1ff) + 1;
+
+  uint16_t mask = get_mask_set();
+  bool check = get_mask_check() != 0;
+
+  // rows are copied top to bottom, each one read in full before it's
+  // written, so a copy onto an overlapping row to its left or right comes
+  // out right.
+
+  uint16_t row[1024];
+  uint16_t background[1024];
+
+  for (int y = 0; y < count.y; y++) {
+    vram_read_row(source.x, source.y + y, row, count.x);
+
+    if (check) {
+      vram_read_row(target.x, target.y + y, background, count.x);
+    }
+
+    apply_mask(row, check ? background : nullptr, mask, count.x);
+
+    vram_write_row(target.x, target.y + y, row, count.x);
+  }
+}
 
 
 void gpu_t::copy_wram_to_vram() {
   auto &transfer = cpu_to_gpu_transfer;
   transfer.reg.x = fifo.buffer[1] & 0xffff;
   transfer.reg.y = fifo.buffer[1] >> 16;
-  transfer.reg.w = fifo.buffer[2] & 0xffff;
-  transfer.reg.h = fifo.buffer[2] >> 16;
+  transfer.reg.w = ((fifo.buffer[2] - 1) & 0x3ff) + 1;
+  transfer.reg.h = (((fifo.buffer[2] >> 16) - 1) & 0x1ff) + 1;
 
   transfer.run.x = 0;
   transfer.run.y = 0;
@@ -72,8 +127,8 @@ void gpu_t::copy_vram_to_wram() {
   auto &transfer = gpu_to_cpu_transfer;
   transfer.reg.x = fifo.buffer[1] & 0xffff;
   transfer.reg.y = fifo.buffer[1] >> 16;
-  transfer.reg.w = fifo.buffer[2] & 0xffff;
-  transfer.reg.h = fifo.buffer[2] >> 16;
+  transfer.reg.w = ((fifo.buffer[2] - 1) & 0x3ff) + 1;
+  transfer.reg.h = (((fifo.buffer[2] >> 16) - 1) & 0x1ff) + 1;
 
   transfer.run.x = 0;
   transfer.run.y = 0;
@@ -83,14 +138,16 @@ void gpu_t::copy_vram_to_wram() {
 
 void gpu_t::gp0(uint32_t data) {
   if (cpu_to_gpu_transfer.run.active) {
-    uint16_t lower = uint16_t(data >> 0);
-    uint16_t upper = uint16_t(data >> 16);
-
-    vram_transfer_write(lower);
-    vram_transfer_write(upper);
+    vram_transfer_write(&data, 1);
     return;
   }
 
+  if (polyline.active) {
+    gpu_stats_t::timer_t timer(stats, gpu_stats_t::line);
+
+    return draw_polyline(data);
+  }
+
   fifo.buffer[fifo.wr] = data;
   fifo.wr = (fifo.wr + 1) & 0xf;
 
@@ -99,6 +156,16 @@ void gpu_t::gp0(uint32_t data) {
   if (fifo.wr == command_size[command]) {
     fifo.wr = 0;
 
+    if (tiles != nullptr && gpu_tiles_t::can_defer(command) == false) {
+      tiles->flush();
+    }
+
+    if (stats != nullptr) {
+      stats->add_command(gpu_stats_t::get_class(command));
+    }
+
+    gpu_stats_t::timer_t timer(stats, gpu_stats_t::get_class(command));
+
     switch (command & 0xe0) {
       case 0x20:
         return draw_polygon();
@@ -130,9 +197,7 @@ void gpu_t::gp0(uint32_t data) {
         return fill_rectangle();
 
       case 0xe1:
-        status &= ~0x87ff;
-        status |= (fifo.buffer[0] << 0) & 0x7ff;
-        status |= (fifo.buffer[0] << 4) & 0x8000;
+        status = gp0_status(status, fifo.buffer[0]);
 
         textured_rectangle_x_flip = ((fifo.buffer[0] >> 12) & 1) != 0;
         textured_rectangle_y_flip = ((fifo.buffer[0] >> 13) & 1) != 0;
@@ -143,6 +208,7 @@ void gpu_t::gp0(uint32_t data) {
         texture_window_mask_y = utility::uclip<5>(fifo.buffer[0] >> 5);
         texture_window_offset_x = utility::uclip<5>(fifo.buffer[0] >> 10);
         texture_window_offset_y = utility::uclip<5>(fifo.buffer[0] >> 15);
+        update_texture_window();
         break;
 
       case 0xe3:
@@ -161,8 +227,7 @@ void gpu_t::gp0(uint32_t data) {
         break;
 
       case 0xe6:
-        status &= ~0x1800;
-        status |= (fifo.buffer[0] << 11) & 0x1800;
+        status = gp0_status(status, fifo.buffer[0]);
         break;
 
       default:
@@ -1,12 +1,56 @@
 #include "gpu/gpu.hpp"
 
+#include "gpu/gpu-tiles.hpp"
 #include "utility.hpp"
 
 
+uint32_t gpu_t::gp1_status(uint32_t status, uint32_t data) {
+  switch ((data >> 24) & 0x3f) {
+    case 0x00:
+      return 0x14802000;
+
+    case 0x02:
+      return status & ~0x01000000;
+
+    case 0x03:
+      status &= ~0x00800000;
+      status |= (data << 23) & 0x00800000;
+      break;
+
+    case 0x04:
+      status &= ~0x60000000;
+      status |= (data << 29) & 0x60000000;
+      break;
+
+    case 0x08:
+      status &= ~0x7f4000;
+      status |= (data << 17) & 0x7e0000;
+      status |= (data << 10) & 0x10000;
+      status |= (data << 7) & 0x4000;
+      break;
+  }
+
+  return status;
+}
+
+
 void gpu_t::gp1(uint32_t data) {
+  // waiting primitives pick up the mask bits from 'status' when they're
+  // drawn, so they have to be drawn before a reset changes them.
+
+  if (tiles != nullptr) {
+    switch ((data >> 24) & 0x3f) {
+      case 0x00:
+      case 0x01:
+        tiles->flush();
+        break;
+    }
+  }
+
+  status = gp1_status(status, data);
+
   switch ((data >> 24) & 0x3f) {
     case 0x00:
-      status = 0x14802000;
       textured_rectangle_x_flip = 0;
       textured_rectangle_y_flip = 0;
       break;
@@ -14,20 +58,13 @@ void gpu_t::gp1(uint32_t data) {
     case 0x01:
       fifo.wr = 0;
       fifo.rd = 0;
+      polyline.active = false;
       break;
 
     case 0x02:
-      status &= ~0x01000000;
-      break;
-
     case 0x03:
-      status &= ~0x00800000;
-      status |= (data << 23) & 0x00800000;
-      break;
-
     case 0x04:
-      status &= ~0x60000000;
-      status |= (data << 29) & 0x60000000;
+    case 0x08:
       break;
 
     case 0x05:
@@ -45,13 +82,6 @@ void gpu_t::gp1(uint32_t data) {
       display_area_y2 = utility::uclip<10>(data >> 10);
       break;
 
-    case 0x08:
-      status &= ~0x7f4000;
-      status |= (data << 17) & 0x7e0000;
-      status |= (data << 10) & 0x10000;
-      status |= (data << 7) & 0x4000;
-      break;
-
     case 0x10:
     case 0x11:
     case 0x12:
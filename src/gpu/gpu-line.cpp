@@ -1,8 +1,251 @@
 #include "gpu/gpu.hpp"
 
-#include <cstdio>
+#include <cstdlib>
+#include "gpu/gpu-raster.hpp"
+#include "gpu/gpu-stats.hpp"
+#include "utility.hpp"
+
+
+// Line Commands
+//
+// 25    | Semi Transparency (0=Off, 1=On)
+// 27    | Polyline (0=Two vertices, 1=Until a terminator word)
+// 28    | Shading (0=Flat, 1=Gouraud)
+//
+// Lines are never textured, bits 24 and 26 are ignored.
+
+
+// Positions and colours are stepped in fixed point, one pixel along the
+// longer axis at a time. Both ends are drawn. Values are scaled up by
+// multiplying, since they can be negative.
+
+static const int POSITION_BITS = 32;
+static const int COLOR_BITS = 12;
+
+
+static gpu_t::color_t decode_color(uint32_t value) {
+  gpu_t::color_t result;
+
+  result.r = utility::uclip<8>(value >> (8 * 0));
+  result.g = utility::uclip<8>(value >> (8 * 1));
+  result.b = utility::uclip<8>(value >> (8 * 2));
+
+  return result;
+}
+
+
+static gpu_t::point_t decode_point(gpu_t &state, uint32_t value) {
+  gpu_t::point_t result;
+
+  result.x = state.x_offset + utility::sclip<11>(value);
+  result.y = state.y_offset + utility::sclip<11>(value >> 16);
+
+  return result;
+}
+
+
+static int64_t get_position_step(int32_t delta, int32_t steps) {
+  if (steps == 0) {
+    return 0;
+  }
+
+  return (int64_t(delta) * (int64_t(1) << POSITION_BITS)) / steps;
+}
+
+
+static int32_t get_color_step(int32_t delta, int32_t steps) {
+  if (steps == 0) {
+    return 0;
+  }
+
+  return (delta * (1 << COLOR_BITS)) / steps;
+}
+
+
+template<uint32_t flags>
+void gpu_t::draw_line(line_t &line) {
+  const point_t *p = line.points;
+  const color_t *c = line.colors;
+
+  int32_t dx = p[1].x - p[0].x;
+  int32_t dy = p[1].y - p[0].y;
+
+  // the hardware skips lines that are too long
+
+  if (std::abs(dx) >= 1024 || std::abs(dy) >= 512) {
+    return;
+  }
+
+  int32_t steps = std::max(std::abs(dx), std::abs(dy));
+
+  int64_t step_x = get_position_step(dx, steps);
+  int64_t step_y = get_position_step(dy, steps);
+
+  // starting half way into the pixel rounds to the nearest one. the nudge
+  // makes halves round the same way whichever way the line goes.
+
+  int64_t x = (int64_t(p[0].x) * (int64_t(1) << POSITION_BITS)) + (int64_t(1) << (POSITION_BITS - 1));
+  int64_t y = (int64_t(p[0].y) * (int64_t(1) << POSITION_BITS)) + (int64_t(1) << (POSITION_BITS - 1));
+
+  if (step_x < 0) {
+    x -= 1024;
+  }
+
+  if (step_y < 0) {
+    y -= 1024;
+  }
+
+  int32_t step_r = get_color_step(c[1].r - c[0].r, steps);
+  int32_t step_g = get_color_step(c[1].g - c[0].g, steps);
+  int32_t step_b = get_color_step(c[1].b - c[0].b, steps);
+
+  int32_t r = (c[0].r << COLOR_BITS) + (1 << (COLOR_BITS - 1));
+  int32_t g = (c[0].g << COLOR_BITS) + (1 << (COLOR_BITS - 1));
+  int32_t b = (c[0].b << COLOR_BITS) + (1 << (COLOR_BITS - 1));
+
+  uint64_t written = 0;
+
+  for (int32_t i = 0; i <= steps; i++) {
+    point_t point;
+    point.x = int32_t(x >> POSITION_BITS);
+    point.y = int32_t(y >> POSITION_BITS);
+
+    color_t shade;
+    shade.r = uint8_t(r >> COLOR_BITS);
+    shade.g = uint8_t(g >> COLOR_BITS);
+    shade.b = uint8_t(b >> COLOR_BITS);
+
+    if (draw_point<flags>(point, shade, 0)) {
+      written++;
+    }
+
+    x += step_x;
+    y += step_y;
+    r += step_r;
+    g += step_g;
+    b += step_b;
+  }
+
+  if (stats != nullptr) {
+    stats->add_pixels(flags, uint64_t(steps) + 1, written);
+  }
+}
+
+
+typedef void (gpu_t::*draw_line_t)(gpu_t::line_t &);
+
+
+// lines are never textured, the textured entries are never used and share
+// the untextured code.
+
+template<uint32_t flags>
+struct draw_line_entry_t {
+  static draw_line_t get() {
+    return &gpu_t::draw_line<flags & (gpu_t::raster_blend | (3 << gpu_t::raster_mode_shift) | gpu_t::raster_dither)>;
+  }
+};
+
+
+static draw_line_t *get_draw_line_table() {
+  static draw_line_t table[256];
+
+  raster_table_t<draw_line_t, draw_line_entry_t>::fill(table);
+
+  return table;
+}
+
+
+void gpu_t::draw_line(uint32_t flags, line_t &line) {
+  static draw_line_t *table = get_draw_line_table();
+
+  (this->*table[flags])(line);
+}
+
+
+bool gpu_t::is_polyline_end(uint32_t data) {
+  return (data & 0xf000f000) == 0x50005000;
+}
+
+
+static void draw_segment(gpu_t &state, uint32_t command, gpu_t::line_t &line) {
+  line.tev.palette_page_x = 0;
+  line.tev.palette_page_y = 0;
+  line.tev.texture_colors = 0;
+  line.tev.texture_page_x = 0;
+  line.tev.texture_page_y = 0;
+  line.tev.color_mix_mode = (state.status >> 5) & 3;
+  line.tev.texels = nullptr;
+
+  // only shaded lines are dithered, and only while GPUSTAT bit 9 is set
+
+  bool dither =
+    (command & (1 << 28)) != 0 &&
+    (state.status & (1 << 9)) != 0;
+
+  uint32_t flags = gpu_t::get_raster_flags(
+    command & ~((1 << 24) | (1 << 26)), line.tev, dither);
+
+  state.draw_line(flags, line);
+}
 
 
 void gpu_t::draw_line() {
-  printf("gpu::draw_line(0x%02x)\n", fifo.buffer[0] >> 24);
+  uint32_t command = fifo.buffer[0];
+  bool shaded = (command & (1 << 28)) != 0;
+
+  line_t line;
+  line.colors[0] = decode_color(fifo.buffer[0]);
+  line.points[0] = decode_point(*this, fifo.buffer[1]);
+
+  if (command & (1 << 27)) {
+    // the rest of the vertices come in through gp0, see draw_polyline
+
+    polyline.active = true;
+    polyline.has_color = false;
+    polyline.command = command;
+    polyline.color = line.colors[0];
+    polyline.point = line.points[0];
+    return;
+  }
+
+  if (shaded) {
+    line.colors[1] = decode_color(fifo.buffer[2]);
+    line.points[1] = decode_point(*this, fifo.buffer[3]);
+  }
+  else {
+    line.colors[1] = line.colors[0];
+    line.points[1] = decode_point(*this, fifo.buffer[2]);
+  }
+
+  draw_segment(*this, command, line);
+}
+
+
+void gpu_t::draw_polyline(uint32_t data) {
+  if (is_polyline_end(data)) {
+    polyline.active = false;
+    return;
+  }
+
+  bool shaded = (polyline.command & (1 << 28)) != 0;
+
+  // shaded polylines send a colour ahead of each vertex
+
+  if (shaded && polyline.has_color == false) {
+    polyline.next_color = decode_color(data);
+    polyline.has_color = true;
+    return;
+  }
+
+  line_t line;
+  line.colors[0] = polyline.color;
+  line.colors[1] = shaded ? polyline.next_color : polyline.color;
+  line.points[0] = polyline.point;
+  line.points[1] = decode_point(*this, data);
+
+  draw_segment(*this, polyline.command, line);
+
+  polyline.has_color = false;
+  polyline.color = line.colors[1];
+  polyline.point = line.points[1];
 }
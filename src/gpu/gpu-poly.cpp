@@ -1,8 +1,15 @@
 #include "gpu/gpu.hpp"
 
 #include <algorithm>
+#include "gpu/gpu-raster.hpp"
+#include "gpu/gpu-stats.hpp"
+#include "gpu/gpu-tiles.hpp"
 #include "utility.hpp"
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 
 static const int32_t point_factor_lut[4] = {
   1, 2, 2, 3
@@ -113,6 +120,7 @@ static gpu_t::tev_t get_tev(gpu_t &state, uint32_t command) {
   uint32_t texpage = state.fifo.buffer[1 * factor + 2] >> 16;
 
   gpu_t::tev_t result;
+  result.texels = nullptr;
 
   //  11    Texture Disable (0=Normal, 1=Disable if GP1(09h).Bit0=1)   ;GPUSTAT.15
 
@@ -143,6 +151,11 @@ static bool is_clockwise(const gpu_t::point_t *p) {
 }
 
 
+static uint64_t get_area(gpu_t::point_t min, gpu_t::point_t max) {
+  return uint64_t(max.x - min.x + 1) * uint64_t(max.y - min.y + 1);
+}
+
+
 static int32_t edge_function(const gpu_t::point_t &a, const gpu_t::point_t &b, const gpu_t::point_t &c) {
   return
     ((a.x - b.x) * (c.y - b.y)) -
@@ -150,60 +163,51 @@ static int32_t edge_function(const gpu_t::point_t &a, const gpu_t::point_t &b, c
 }
 
 
-static gpu_t::color_t color_lerp(const gpu_t::color_t *c, int32_t w0, int32_t w1, int32_t w2) {
-  gpu_t::color_t color;
-  color.r = ((w0 * c[0].r) + (w1 * c[1].r) + (w2 * c[2].r)) / (w0 + w1 + w2);
-  color.g = ((w0 * c[0].g) + (w1 * c[1].g) + (w2 * c[2].g)) / (w0 + w1 + w2);
-  color.b = ((w0 * c[0].b) + (w1 * c[1].b) + (w2 * c[2].b)) / (w0 + w1 + w2);
+// Colours and texture coordinates are stepped across the triangle in fixed
+// point, like the hardware does, from gradients worked out once per
+// triangle. The bias keeps the stepping error from dropping a value that
+// lands exactly on an integer down a step.
 
-  return color;
-}
+static const int FRACTION_BITS = 20;
+static const int64_t FRACTION_ONE = int64_t(1) << FRACTION_BITS;
+static const int64_t FRACTION_BIAS = FRACTION_ONE >> 8;
 
 
-static gpu_t::point_t point_lerp(const gpu_t::point_t *t, int32_t w0, int32_t w1, int32_t w2) {
-  gpu_t::point_t point;
-  point.x = ((w0 * t[0].x) + (w1 * t[1].x) + (w2 * t[2].x)) / (w0 + w1 + w2);
-  point.y = ((w0 * t[0].y) + (w1 * t[1].y) + (w2 * t[2].y)) / (w0 + w1 + w2);
+static int64_t floor_div(int64_t n, int64_t d) {
+  int64_t q = n / d;
 
-  return point;
+  return (n % d != 0 && n < 0)
+    ? q - 1
+    : q
+    ;
 }
 
 
-bool gpu_t::get_color(uint32_t command, triangle_t &triangle, int32_t w0, int32_t w1, int32_t w2, gpu_t::color_t &color) {
-  bool shaded = (command & (1 << 26)) == 0;
-  bool blended = (command & (1 << 24)) != 0;
-
-  if (shaded) {
-    color = color_lerp(triangle.colors, w0, w1, w2);
-    return true;
-  }
+static gpu_t::gradient_t get_gradient(const gpu_t::gradient_t *e, int32_t area, int32_t a0, int32_t a1, int32_t a2) {
+  int64_t n  = (int64_t(e[0].start) * a0) + (int64_t(e[1].start) * a1) + (int64_t(e[2].start) * a2);
+  int64_t nx = (int64_t(e[0].dx   ) * a0) + (int64_t(e[1].dx   ) * a1) + (int64_t(e[2].dx   ) * a2);
+  int64_t ny = (int64_t(e[0].dy   ) * a0) + (int64_t(e[1].dy   ) * a1) + (int64_t(e[2].dy   ) * a2);
 
-  gpu_t::point_t coord = point_lerp(triangle.coords, w0, w1, w2);
+  // values outside the triangle can overflow, but the steps wrap the same
+  // way, and everything inside comes out right.
 
-  if (blended) {
-    color = get_texture_color(triangle.tev, coord);
-  }
-  else {
-    gpu_t::color_t color1 = get_texture_color(triangle.tev, coord);
-    gpu_t::color_t color2 = color_lerp(triangle.colors, w0, w1, w2);
+  gpu_t::gradient_t result;
+  result.start = int32_t(uint32_t(floor_div(n * FRACTION_ONE, area) + FRACTION_BIAS));
+  result.dx = int32_t(uint32_t(floor_div((nx * FRACTION_ONE * 2) + area, area * 2)));
+  result.dy = int32_t(uint32_t(floor_div((ny * FRACTION_ONE * 2) + area, area * 2)));
 
-    color.r = std::min(255, (color1.r * color2.r) / 128);
-    color.g = std::min(255, (color1.g * color2.g) / 128);
-    color.b = std::min(255, (color1.b * color2.b) / 128);
-  }
-
-  return (color.r | color.g | color.b) > 0;
+  return result;
 }
 
 
-void gpu_t::draw_triangle(gpu_t &state, uint32_t command, triangle_t &triangle) {
+static bool setup_triangle(gpu_t &state, gpu_t::triangle_t &triangle) {
   const gpu_t::point_t *v = triangle.points;
 
-  gpu_t::point_t min;
+  gpu_t::point_t &min = triangle.min;
   min.x = std::min(v[0].x, std::min(v[1].x, v[2].x));
   min.y = std::min(v[0].y, std::min(v[1].y, v[2].y));
 
-  gpu_t::point_t max;
+  gpu_t::point_t &max = triangle.max;
   max.x = std::max(v[0].x, std::max(v[1].x, v[2].x));
   max.y = std::max(v[0].y, std::max(v[1].y, v[2].y));
 
@@ -212,82 +216,354 @@ void gpu_t::draw_triangle(gpu_t &state, uint32_t command, triangle_t &triangle)
   max.x = std::min(max.x, state.drawing_area_x2);
   max.y = std::min(max.y, state.drawing_area_y2);
 
-  int32_t dx[3];
-  dx[0] = v[2].y - v[1].y;
-  dx[1] = v[0].y - v[2].y;
-  dx[2] = v[1].y - v[0].y;
+  if (min.x > max.x || min.y > max.y) {
+    return false;
+  }
+
+  gpu_t::gradient_t *e = triangle.edges;
+
+  e[0].dx = v[2].y - v[1].y;
+  e[1].dx = v[0].y - v[2].y;
+  e[2].dx = v[1].y - v[0].y;
+
+  e[0].dy = v[1].x - v[2].x;
+  e[1].dy = v[2].x - v[0].x;
+  e[2].dy = v[0].x - v[1].x;
+
+  e[0].start = edge_function(min, v[1], v[2]);
+  e[1].start = edge_function(min, v[2], v[0]);
+  e[2].start = edge_function(min, v[0], v[1]);
+
+  for (int i = 0; i < 3; i++) {
+    triangle.edge_bias[i] = (e[i].dy > 0 || (e[i].dy == 0 && e[i].dx > 0)) ? (-1) : 0;
+  }
+
+  // the vertices are in clockwise order, so the area can't be negative. a
+  // triangle without any area doesn't cover any pixels.
+
+  int32_t area = e[0].start + e[1].start + e[2].start;
+
+  if (area <= 0) {
+    return false;
+  }
+
+  const gpu_t::color_t *c = triangle.colors;
+  const gpu_t::point_t *t = triangle.coords;
+
+  triangle.attributes[0] = get_gradient(e, area, c[0].r, c[1].r, c[2].r);
+  triangle.attributes[1] = get_gradient(e, area, c[0].g, c[1].g, c[2].g);
+  triangle.attributes[2] = get_gradient(e, area, c[0].b, c[1].b, c[2].b);
+  triangle.attributes[3] = get_gradient(e, area, t[0].x, t[1].x, t[2].x);
+  triangle.attributes[4] = get_gradient(e, area, t[0].y, t[1].y, t[2].y);
+
+  return true;
+}
+
+
+#if defined(__SSE2__) || defined(_M_X64)
+
+
+// The vector path works out coverage and the interpolated attributes for
+// eight pixels at a time, in two sets of four 32-bit lanes, stepping the
+// same gradients as the scalar loop.
+
+
+struct lanes_t {
+  __m128i lo;
+  __m128i hi;
+};
+
+
+// like the scalar loop, attributes are stepped in uint32_t so they can wrap
 
-  int32_t dy[3];
-  dy[0] = v[1].x - v[2].x;
-  dy[1] = v[2].x - v[0].x;
-  dy[2] = v[0].x - v[1].x;
+static lanes_t lanes_start(uint32_t value, uint32_t step) {
+  lanes_t result;
+  result.lo = _mm_add_epi32(_mm_set1_epi32(int32_t(value)), _mm_setr_epi32(0, int32_t(step), int32_t(step * 2), int32_t(step * 3)));
+  result.hi = _mm_add_epi32(result.lo, _mm_set1_epi32(int32_t(step * 4)));
 
-  int32_t c[3];
-  c[0] = (dy[0] > 0 || (dy[0] == 0 && dx[0] > 0)) ? (-1) : 0;
-  c[1] = (dy[1] > 0 || (dy[1] == 0 && dx[1] > 0)) ? (-1) : 0;
-  c[2] = (dy[2] > 0 || (dy[2] == 0 && dx[2] > 0)) ? (-1) : 0;
+  return result;
+}
+
+
+static void lanes_step(lanes_t &lanes, __m128i step) {
+  lanes.lo = _mm_add_epi32(lanes.lo, step);
+  lanes.hi = _mm_add_epi32(lanes.hi, step);
+}
+
+
+static uint32_t lanes_above(const lanes_t &lanes, int32_t bias) {
+  __m128i c = _mm_set1_epi32(bias);
+  __m128i lo = _mm_cmpgt_epi32(lanes.lo, c);
+  __m128i hi = _mm_cmpgt_epi32(lanes.hi, c);
+
+  return
+    (_mm_movemask_ps(_mm_castsi128_ps(lo)) << 0) |
+    (_mm_movemask_ps(_mm_castsi128_ps(hi)) << 4);
+}
+
+
+static void lanes_value(const lanes_t &lanes, int32_t *out) {
+  _mm_storeu_si128((__m128i *)&out[0], _mm_srai_epi32(lanes.lo, FRACTION_BITS));
+  _mm_storeu_si128((__m128i *)&out[4], _mm_srai_epi32(lanes.hi, FRACTION_BITS));
+}
+
+
+template<uint32_t flags>
+void gpu_t::draw_triangle_simd(triangle_t &triangle) {
+  gpu_t::point_t min = triangle.min;
+  gpu_t::point_t max = triangle.max;
+
+  // edge functions, then r, g, b, u, v
+
+  gpu_t::gradient_t values[8];
+  std::copy(triangle.edges, triangle.edges + 3, values);
+  std::copy(triangle.attributes, triangle.attributes + 5, values + 3);
+
+  uint32_t start[8];
+  __m128i step[8];
+
+  for (int i = 0; i < 8; i++) {
+    start[i] = uint32_t(values[i].start);
+    step[i] = _mm_set1_epi32(int32_t(uint32_t(values[i].dx) * 8));
+  }
+
+  const int32_t *c = triangle.edge_bias;
+
+  const sampler_t sampler = get_sampler(triangle.tev);
 
-  int32_t row[3];
-  row[0] = edge_function(min, v[1], v[2]);
-  row[1] = edge_function(min, v[2], v[0]);
-  row[2] = edge_function(min, v[0], v[1]);
+  alignas(16) int32_t attributes[5][8];
+
+  uint64_t written = 0;
 
   gpu_t::point_t point;
 
   for (point.y = min.y; point.y <= max.y; point.y++) {
-    int32_t w0 = row[0];
-    row[0] += dy[0];
+    lanes_t lanes[8];
+
+    for (int i = 0; i < 8; i++) {
+      lanes[i] = lanes_start(start[i], uint32_t(values[i].dx));
+      start[i] += uint32_t(values[i].dy);
+    }
 
-    int32_t w1 = row[1];
-    row[1] += dy[1];
+    for (point.x = min.x; point.x <= max.x; point.x += 8) {
+      uint32_t mask =
+        lanes_above(lanes[0], c[0]) &
+        lanes_above(lanes[1], c[1]) &
+        lanes_above(lanes[2], c[2]);
 
-    int32_t w2 = row[2];
-    row[2] += dy[2];
+      int32_t count = std::min(8, max.x - point.x + 1);
+      mask &= (1 << count) - 1;
 
-    for (point.x = min.x; point.x <= max.x; point.x++) {
-      if (w0 > c[0] && w1 > c[1] && w2 > c[2]) {
-        gpu_t::color_t color;
+      if (mask) {
+        for (int i = 0; i < 5; i++) {
+          lanes_value(lanes[3 + i], attributes[i]);
+        }
 
-        if (get_color(command, triangle, w0, w1, w2, color)) {
-          if (command & (1 << 25)) {
-            gpu_t::color_t bg = uint16_to_color(vram_read(point.x, point.y));
-
-            switch (triangle.tev.color_mix_mode) {
-              case 0:
-                color.r = (bg.r + color.r) / 2;
-                color.g = (bg.g + color.g) / 2;
-                color.b = (bg.b + color.b) / 2;
-                break;
-
-              case 1:
-                color.r = std::min(255, bg.r + color.r);
-                color.g = std::min(255, bg.g + color.g);
-                color.b = std::min(255, bg.b + color.b);
-                break;
-
-              case 2:
-                color.r = std::max(0, bg.r - color.r);
-                color.g = std::max(0, bg.g - color.g);
-                color.b = std::max(0, bg.b - color.b);
-                break;
-
-              case 3:
-                color.r = std::min(255, bg.r + color.r / 4);
-                color.g = std::min(255, bg.g + color.g / 4);
-                color.b = std::min(255, bg.b + color.b / 4);
-                break;
-            }
+        span_t span;
+        uint32_t write = 0;
+
+        for (int k = 0; k < 8; k++) {
+          if ((mask & (1 << k)) == 0) {
+            continue;
           }
 
-          state.draw_point(point, color);
+          gpu_t::color_t shade;
+          shade.r = uint8_t(attributes[0][k]);
+          shade.g = uint8_t(attributes[1][k]);
+          shade.b = uint8_t(attributes[2][k]);
+
+          gpu_t::point_t coord;
+          coord.x = attributes[3][k];
+          coord.y = attributes[4][k];
+
+          gpu_t::color_t color;
+
+          if (get_color<flags>(sampler, shade, coord, color, span.mask[k])) {
+            span.r[k] = color.r;
+            span.g[k] = color.g;
+            span.b[k] = color.b;
+            write |= 1 << k;
+            written++;
+          }
+        }
+
+        if (write) {
+          draw_span<flags>(point, write, span);
         }
       }
 
-      w0 += dx[0];
-      w1 += dx[1];
-      w2 += dx[2];
+      for (int i = 0; i < 8; i++) {
+        lanes_step(lanes[i], step[i]);
+      }
     }
   }
+
+  if (stats != nullptr) {
+    stats->add_pixels(flags, get_area(min, max), written);
+  }
+}
+
+
+#endif
+
+
+template<uint32_t flags>
+void gpu_t::draw_triangle(triangle_t &triangle) {
+#if defined(__SSE2__) || defined(_M_X64)
+  bool feedback = (flags & raster_textured) && samples_target(triangle.tev, triangle.min, triangle.max);
+
+  if (feedback == false) {
+    return draw_triangle_simd<flags>(triangle);
+  }
+#endif
+
+  const gpu_t::gradient_t *e = triangle.edges;
+  const gpu_t::gradient_t *a = triangle.attributes;
+  const int32_t *c = triangle.edge_bias;
+
+  const sampler_t sampler = get_sampler(triangle.tev);
+
+  int32_t row[3] = { e[0].start, e[1].start, e[2].start };
+  uint32_t row_attributes[5];
+
+  uint64_t written = 0;
+
+  for (int i = 0; i < 5; i++) {
+    row_attributes[i] = uint32_t(a[i].start);
+  }
+
+  gpu_t::point_t point;
+
+  for (point.y = triangle.min.y; point.y <= triangle.max.y; point.y++) {
+    int32_t w[3];
+    uint32_t attributes[5];
+
+    for (int i = 0; i < 3; i++) {
+      w[i] = row[i];
+      row[i] += e[i].dy;
+    }
+
+    for (int i = 0; i < 5; i++) {
+      attributes[i] = row_attributes[i];
+      row_attributes[i] += uint32_t(a[i].dy);
+    }
+
+    for (point.x = triangle.min.x; point.x <= triangle.max.x; point.x++) {
+      if (w[0] > c[0] && w[1] > c[1] && w[2] > c[2]) {
+        gpu_t::color_t shade;
+        shade.r = uint8_t(int32_t(attributes[0]) >> FRACTION_BITS);
+        shade.g = uint8_t(int32_t(attributes[1]) >> FRACTION_BITS);
+        shade.b = uint8_t(int32_t(attributes[2]) >> FRACTION_BITS);
+
+        gpu_t::point_t coord;
+        coord.x = int32_t(attributes[3]) >> FRACTION_BITS;
+        coord.y = int32_t(attributes[4]) >> FRACTION_BITS;
+
+        gpu_t::color_t color;
+        uint16_t mask;
+
+        if (get_color<flags>(sampler, shade, coord, color, mask)) {
+          draw_point<flags>(point, color, mask);
+          written++;
+        }
+      }
+
+      for (int i = 0; i < 3; i++) {
+        w[i] += e[i].dx;
+      }
+
+      for (int i = 0; i < 5; i++) {
+        attributes[i] += uint32_t(a[i].dx);
+      }
+    }
+  }
+
+  if (stats != nullptr) {
+    stats->add_pixels(flags, get_area(triangle.min, triangle.max), written);
+  }
+}
+
+
+typedef void (gpu_t::*draw_triangle_t)(gpu_t::triangle_t &);
+
+
+template<uint32_t flags>
+struct draw_triangle_entry_t {
+  static draw_triangle_t get() {
+    return &gpu_t::draw_triangle<flags>;
+  }
+};
+
+
+static draw_triangle_t *get_draw_triangle_table() {
+  static draw_triangle_t table[256];
+
+  raster_table_t<draw_triangle_t, draw_triangle_entry_t>::fill(table);
+
+  return table;
+}
+
+
+void gpu_t::draw_triangle(uint32_t flags, triangle_t &triangle) {
+  static draw_triangle_t *table = get_draw_triangle_table();
+
+  (this->*table[flags])(triangle);
+}
+
+
+bool gpu_t::clip_triangle(triangle_t &triangle, point_t min, point_t max) {
+  min.x = std::max(min.x, triangle.min.x);
+  min.y = std::max(min.y, triangle.min.y);
+  max.x = std::min(max.x, triangle.max.x);
+  max.y = std::min(max.y, triangle.max.y);
+
+  if (min.x > max.x || min.y > max.y) {
+    return false;
+  }
+
+  // the gradients start at the top left of the bounding box, moving it
+  // along steps them exactly the way the pixel loops would have.
+
+  uint32_t x = uint32_t(min.x - triangle.min.x);
+  uint32_t y = uint32_t(min.y - triangle.min.y);
+
+  for (auto &e : triangle.edges) {
+    e.start = int32_t(uint32_t(e.start) + (uint32_t(e.dx) * x) + (uint32_t(e.dy) * y));
+  }
+
+  for (auto &a : triangle.attributes) {
+    a.start = int32_t(uint32_t(a.start) + (uint32_t(a.dx) * x) + (uint32_t(a.dy) * y));
+  }
+
+  triangle.min = min;
+  triangle.max = max;
+
+  return true;
+}
+
+
+void gpu_t::draw_triangle(gpu_t &state, uint32_t command, triangle_t &triangle) {
+  if (setup_triangle(state, triangle) == false) {
+    return;
+  }
+
+  // shaded and modulated triangles are dithered, while GPUSTAT bit 9 is set
+
+  bool shaded = (command & (1 << 28)) != 0;
+  bool modulated = (command & (1 << 26)) != 0 && (command & (1 << 24)) == 0;
+  bool dither = (shaded || modulated) && (state.status & (1 << 9)) != 0;
+
+  uint32_t flags = get_raster_flags(command, triangle.tev, dither);
+
+  if (state.tiles != nullptr) {
+    return state.tiles->push(flags, triangle);
+  }
+
+  if (flags & raster_textured) {
+    state.bind_texture(triangle.tev, triangle.min, triangle.max);
+  }
+
+  state.draw_triangle(flags, triangle);
 }
 
 
@@ -0,0 +1,346 @@
+#ifndef __psxact_gpu_raster__
+#define __psxact_gpu_raster__
+
+
+#include <algorithm>
+#include "gpu/gpu.hpp"
+#include "gpu/gpu-blend.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+
+// The pixel loops are generated once for every combination of raster flags
+// that makes a difference, and the dispatch tables map all 256 indices onto
+// them. Flags that don't matter (the blend mode of an opaque primitive, the
+// depth of an untextured one) are dropped, so there's no duplicate code.
+
+
+constexpr uint32_t get_raster_depth(uint32_t flags) {
+  return ((flags >> gpu_t::raster_depth_shift) & 3) == 3
+    ? 2
+    : ((flags >> gpu_t::raster_depth_shift) & 3)
+    ;
+}
+
+
+constexpr uint32_t get_raster_mode(uint32_t flags) {
+  return (flags >> gpu_t::raster_mode_shift) & 3;
+}
+
+
+constexpr uint32_t get_canonical_flags(uint32_t flags) {
+  return
+    (flags & gpu_t::raster_dither) |
+    ((flags & gpu_t::raster_textured)
+      ? (flags & (gpu_t::raster_textured | gpu_t::raster_raw)) | (get_raster_depth(flags) << gpu_t::raster_depth_shift)
+      : 0) |
+    ((flags & gpu_t::raster_blend)
+      ? gpu_t::raster_blend | (get_raster_mode(flags) << gpu_t::raster_mode_shift)
+      : 0);
+}
+
+
+// fills 'table' with entry_t<flags>::get(), for every index
+
+template<typename table_t, template<uint32_t> class entry_t, uint32_t index = 255>
+struct raster_table_t {
+  static void fill(table_t *table) {
+    table[index] = entry_t<get_canonical_flags(index)>::get();
+    raster_table_t<table_t, entry_t, index - 1>::fill(table);
+  }
+};
+
+
+template<typename table_t, template<uint32_t> class entry_t>
+struct raster_table_t<table_t, entry_t, 0> {
+  static void fill(table_t *table) {
+    table[0] = entry_t<0>::get();
+  }
+};
+
+
+template<uint32_t flags>
+inline uint16_t gpu_t::get_texel(const sampler_t &sampler, point_t coord) {
+  // texture coordinates wrap around inside the page, then go through the
+  // texture window
+
+  uint32_t u = sampler.window_u[coord.x & 255];
+  uint32_t v = sampler.window_v[coord.y & 255];
+
+  if (get_raster_depth(flags) != 2 && sampler.texels) {
+    return sampler.texels[(v << 8) | u];
+  }
+
+  const uint16_t *vram = sampler.vram;
+  const uint32_t row = sampler.page + (v << 10);
+
+  switch (get_raster_depth(flags)) {
+    case 0: {
+      uint32_t index = (vram[(row + (u >> 2)) & sampler_t::wrap] >> ((u & 3) * 4)) & 15;
+      return vram[(sampler.clut + index) & sampler_t::wrap];
+    }
+
+    case 1: {
+      uint32_t index = (vram[(row + (u >> 1)) & sampler_t::wrap] >> ((u & 1) * 8)) & 255;
+      return vram[(sampler.clut + index) & sampler_t::wrap];
+    }
+
+    default:
+      return vram[(row + u) & sampler_t::wrap];
+  }
+}
+
+
+template<uint32_t flags>
+inline gpu_t::color_t gpu_t::shade_texel(uint16_t texel, color_t shade) {
+  color_t color = uint16_to_color(texel);
+
+  if ((flags & raster_raw) == 0) {
+    color.r = std::min(255, (color.r * shade.r) / 128);
+    color.g = std::min(255, (color.g * shade.g) / 128);
+    color.b = std::min(255, (color.b * shade.b) / 128);
+  }
+
+  return color;
+}
+
+
+template<uint32_t flags>
+inline bool gpu_t::get_color(const sampler_t &sampler, color_t shade, point_t coord, color_t &color, uint16_t &mask) {
+  if (flags & raster_textured) {
+    uint16_t texel = get_texel<flags>(sampler, coord);
+
+    if (texel == 0) {
+      return false;
+    }
+
+    color = shade_texel<flags>(texel, shade);
+    mask = texel & 0x8000;
+  }
+  else {
+    color = shade;
+    mask = 0;
+  }
+
+  return true;
+}
+
+
+// What a drawn pixel leaves over 'bg'. Textured pixels only blend when their
+// texel has bit 15 set, and keep the bit. 'set' and 'check' are the mask
+// settings, see get_mask_set and get_mask_check.
+
+template<uint32_t flags>
+inline void write_pixel(uint16_t &pixel, uint16_t color, uint16_t set, uint16_t check) {
+  uint16_t bg = pixel;
+
+  if (bg & check) {
+    return;
+  }
+
+  if ((flags & gpu_t::raster_blend) && ((flags & gpu_t::raster_textured) == 0 || (color & 0x8000))) {
+    color = blend_pixel<get_raster_mode(flags)>(bg, color) | (color & 0x8000);
+  }
+
+  pixel = color | set;
+}
+
+
+#if defined(__SSE2__) || defined(_M_X64)
+
+
+// write_pixel for the 'lanes' of eight pixels
+
+template<uint32_t flags>
+inline void write_pixels(uint16_t *pixels, __m128i color, uint32_t lanes, uint16_t set, uint16_t check) {
+  __m128i bg = _mm_loadu_si128((const __m128i *)pixels);
+
+  if (flags & gpu_t::raster_blend) {
+    __m128i blended = _mm_or_si128(
+      blend_pixels<get_raster_mode(flags)>(bg, color),
+      _mm_and_si128(color, _mm_set1_epi16(int16_t(0x8000))));
+
+    if (flags & gpu_t::raster_textured) {
+      __m128i semi = _mm_srai_epi16(color, 15);
+
+      color = _mm_or_si128(_mm_and_si128(semi, blended), _mm_andnot_si128(semi, color));
+    }
+    else {
+      color = blended;
+    }
+  }
+
+  color = _mm_or_si128(color, _mm_set1_epi16(int16_t(set)));
+
+  if (check) {
+    __m128i locked = _mm_srai_epi16(bg, 15);
+
+    color = _mm_or_si128(_mm_and_si128(locked, bg), _mm_andnot_si128(locked, color));
+  }
+
+  if (lanes == 0xff) {
+    _mm_storeu_si128((__m128i *)pixels, color);
+    return;
+  }
+
+  // pixels outside 'lanes' are left alone, rather than written back, as
+  // they can belong to a tile that's being drawn on another thread.
+
+  alignas(16) uint16_t colors[8];
+  _mm_store_si128((__m128i *)colors, color);
+
+  for (int k = 0; k < 8; k++) {
+    if (lanes & (1 << k)) {
+      pixels[k] = colors[k];
+    }
+  }
+}
+
+
+#endif
+
+
+// write_pixel for a row of pixels. textured rows skip the pixels whose
+// texel is 0. returns the number of pixels that weren't skipped.
+
+template<uint32_t flags>
+inline uint32_t write_row(uint16_t *pixels, const uint16_t *colors, const uint16_t *texels, int32_t count, uint16_t set, uint16_t check) {
+  uint32_t written = 0;
+  int32_t i = 0;
+
+#if defined(__SSE2__) || defined(_M_X64)
+  const __m128i zero = _mm_setzero_si128();
+
+  for (; i + 8 <= count; i += 8) {
+    uint32_t lanes = 0xff;
+
+    if (flags & gpu_t::raster_textured) {
+      __m128i transparent = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)&texels[i]), zero);
+
+      lanes &= ~_mm_movemask_epi8(_mm_packs_epi16(transparent, zero));
+
+      if (lanes == 0) {
+        continue;
+      }
+    }
+
+    write_pixels<flags>(&pixels[i], _mm_loadu_si128((const __m128i *)&colors[i]), lanes, set, check);
+    written += __builtin_popcount(lanes);
+  }
+#endif
+
+  for (; i < count; i++) {
+    if ((flags & gpu_t::raster_textured) && texels[i] == 0) {
+      continue;
+    }
+
+    write_pixel<flags>(pixels[i], colors[i], set, check);
+    written++;
+  }
+
+  return written;
+}
+
+
+// the dither pattern, repeated so eight entries can be loaded from any
+// phase
+
+static const int16_t dither_span_lut[4][12] = {
+  { -4,  0, -3,  1, -4,  0, -3,  1, -4,  0, -3,  1 },
+  {  2, -2,  3, -1,  2, -2,  3, -1,  2, -2,  3, -1 },
+  { -3,  1, -4,  0, -3,  1, -4,  0, -3,  1, -4,  0 },
+  {  3, -1,  2, -2,  3, -1,  2, -2,  3, -1,  2, -2 }
+};
+
+
+template<uint32_t flags>
+inline bool gpu_t::draw_point(point_t point, color_t color, uint16_t mask) {
+  if (point.x < drawing_area_x1 ||
+      point.x > drawing_area_x2 ||
+      point.y < drawing_area_y1 ||
+      point.y > drawing_area_y2) {
+    return false;
+  }
+
+  uint16_t value;
+
+  if (flags & raster_dither) {
+    const uint8_t *table = dither_table.values[point.y & 3][point.x & 3];
+
+    value = table[color.r] | (table[color.g] << 5) | (table[color.b] << 10);
+  }
+  else {
+    value = color_to_uint16(color);
+  }
+
+  // the drawing area can reach past the bottom of vram, rows wrap around
+
+  uint32_t address = vram_address(point.x, point.y & 511);
+
+  texture_cache.invalidate(address);
+
+  write_pixel<flags>(
+    *(uint16_t *)vram.get_pointer(address),
+    value | mask,
+    get_mask_set(),
+    get_mask_check());
+
+  return true;
+}
+
+
+template<uint32_t flags>
+inline void gpu_t::draw_span(point_t point, uint32_t lanes, const span_t &span) {
+  // the caller has already clipped 'lanes' to the drawing area
+
+#if defined(__SSE2__) || defined(_M_X64)
+  if (point.x <= 1024 - 8) {
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i r = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)span.r), zero);
+    __m128i g = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)span.g), zero);
+    __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)span.b), zero);
+
+    if (flags & raster_dither) {
+      __m128i offset = _mm_loadu_si128((const __m128i *)&dither_span_lut[point.y & 3][point.x & 3]);
+
+      // packus clamps to 0-255
+
+      r = _mm_unpacklo_epi8(_mm_packus_epi16(_mm_add_epi16(r, offset), zero), zero);
+      g = _mm_unpacklo_epi8(_mm_packus_epi16(_mm_add_epi16(g, offset), zero), zero);
+      b = _mm_unpacklo_epi8(_mm_packus_epi16(_mm_add_epi16(b, offset), zero), zero);
+    }
+
+    __m128i color = _mm_or_si128(
+      _mm_srli_epi16(r, 3), _mm_or_si128(
+      _mm_slli_epi16(_mm_srli_epi16(g, 3), 5),
+      _mm_slli_epi16(_mm_srli_epi16(b, 3), 10)));
+
+    if (flags & raster_textured) {
+      color = _mm_or_si128(color, _mm_loadu_si128((const __m128i *)span.mask));
+    }
+
+    texture_cache.invalidate(vram_address(point.x + 0, point.y & 511));
+    texture_cache.invalidate(vram_address(point.x + 7, point.y & 511));
+
+    write_pixels<flags>(vram_data(point.x, point.y & 511), color, lanes, get_mask_set(), get_mask_check());
+    return;
+  }
+#endif
+
+  for (int k = 0; k < 8; k++) {
+    if (lanes & (1 << k)) {
+      color_t color;
+      color.r = span.r[k];
+      color.g = span.g[k];
+      color.b = span.b[k];
+
+      draw_point<flags>({ point.x + k, point.y }, color, (flags & raster_textured) ? span.mask[k] : 0);
+    }
+  }
+}
+
+
+#endif // __psxact_gpu_raster__
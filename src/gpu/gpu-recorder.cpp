@@ -0,0 +1,93 @@
+#include "gpu/gpu-recorder.hpp"
+
+#include "gpu/gpu.hpp"
+#include "state.hpp"
+
+
+gpu_recorder_t::gpu_recorder_t(FILE *file)
+  : file(file)
+  , type(record_gp0)
+  , count(0) {
+
+  uint32_t header[2] = { magic, version };
+  fwrite(header, sizeof(uint32_t), 2, file);
+}
+
+
+gpu_recorder_t::~gpu_recorder_t() {
+  flush();
+  fclose(file);
+}
+
+
+gpu_recorder_t *gpu_recorder_t::open(const char *file_name) {
+  FILE *file = fopen(file_name, "wb");
+  if (file == nullptr) {
+    return nullptr;
+  }
+
+  return new gpu_recorder_t(file);
+}
+
+
+void gpu_recorder_t::write(uint32_t address, const uint32_t *data, uint32_t count) {
+  add(address == GPU_GP0 ? record_gp0 : record_gp1, data, count);
+}
+
+
+void gpu_recorder_t::read(uint32_t count) {
+  add(record_read, nullptr, count);
+}
+
+
+void gpu_recorder_t::end_frame() {
+  flush();
+
+  uint32_t header = record_frame << 28;
+  fwrite(&header, sizeof(uint32_t), 1, file);
+}
+
+
+void gpu_recorder_t::save_state(gpu_t &gpu) {
+  flush();
+
+  state_t state;
+  gpu.serialize(state);
+
+  uint32_t size = uint32_t(state.get_size());
+  uint32_t header = (record_state << 28) | size;
+  uint32_t padding = 0;
+
+  fwrite(&header, sizeof(uint32_t), 1, file);
+  fwrite(state.get_data(), 1, size, file);
+  fwrite(&padding, 1, (4 - (size & 3)) & 3, file);
+}
+
+
+void gpu_recorder_t::add(uint32_t type, const uint32_t *data, uint32_t count) {
+  if (this->type != type || this->count + count > max_words) {
+    flush();
+    this->type = type;
+  }
+
+  this->count += count;
+
+  if (data != nullptr) {
+    words.insert(words.end(), data, data + count);
+  }
+}
+
+
+void gpu_recorder_t::flush() {
+  if (count == 0) {
+    return;
+  }
+
+  uint32_t header = (type << 28) | count;
+
+  fwrite(&header, sizeof(uint32_t), 1, file);
+  fwrite(words.data(), sizeof(uint32_t), words.size(), file);
+
+  count = 0;
+  words.clear();
+}
@@ -0,0 +1,89 @@
+#ifndef __psxact_gpu_recorder__
+#define __psxact_gpu_recorder__
+
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+
+class gpu_t;
+
+
+// Writes everything the GPU is sent to a file, so it can be replayed without
+// the rest of the machine (see tools/gpu-replay.cpp).
+//
+// The file starts with a header:
+//
+//   0     | Magic ("PXGR")
+//   1     | Version
+//
+// followed by records, each a word with the type in the top four bits and a
+// count in the rest, then 'count' words of data. All words are in host order.
+//
+//   0     | GP0 words, VRAM uploads included
+//   1     | GP1 words
+//   2     | GPUREAD reads, no data
+//   3     | End of a frame, no data
+//   4     | A snapshot of gpu_t, 'count' bytes rounded up to whole words
+//
+// Runs of the same type are merged, so a DMA transfer costs one record.
+
+class gpu_recorder_t {
+
+public:
+
+  static const uint32_t magic = 0x52475850; // "PXGR"
+  static const uint32_t version = 1;
+
+  enum {
+    record_gp0,
+    record_gp1,
+    record_read,
+    record_frame,
+    record_state
+  };
+
+  static const uint32_t count_mask = (1 << 28) - 1;
+
+private:
+
+  // a record is written out when it gets this long, or the type changes
+
+  static const uint32_t max_words = 1 << 16;
+
+  FILE *file;
+
+  uint32_t type;
+  uint32_t count;
+  std::vector<uint32_t> words;
+
+public:
+
+  gpu_recorder_t(FILE *file);
+
+  ~gpu_recorder_t();
+
+  static gpu_recorder_t *open(const char *file_name);
+
+  void write(uint32_t address, const uint32_t *data, uint32_t count);
+
+  void read(uint32_t count);
+
+  void end_frame();
+
+  // records the whole of gpu_t, for when it changes other than through its
+  // ports, like a state being loaded.
+
+  void save_state(gpu_t &gpu);
+
+private:
+
+  void add(uint32_t type, const uint32_t *data, uint32_t count);
+
+  void flush();
+
+};
+
+
+#endif // __psxact_gpu_recorder__
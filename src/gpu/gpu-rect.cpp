@@ -1,6 +1,9 @@
 #include "gpu/gpu.hpp"
 
 #include <algorithm>
+#include "gpu/gpu-raster.hpp"
+#include "gpu/gpu-stats.hpp"
+#include "gpu/gpu-tiles.hpp"
 
 
 // Rect Commands
@@ -54,67 +57,200 @@ static int32_t get_y_length(uint32_t *fifo) {
 }
 
 
-bool gpu_t::get_color(uint32_t command, color_t &color, tev_t &tev, point_t &coord) {
-  bool blended = (command & (1 << 24)) != 0;
-  bool textured = (command & (1 << 26)) != 0;
+// fetches a row of texels, already looked up in the CLUT, starting at 'u'
+// and stepping by 'step'.
 
-  if (!textured) {
-    return true;
+template<uint32_t flags>
+void gpu_t::get_texel_row(const sampler_t &sampler, int32_t u, int32_t step, int32_t v, uint16_t *texels, int32_t count) {
+  if (get_raster_depth(flags) != 2 && sampler.texels) {
+    const uint16_t *row = &sampler.texels[sampler.window_v[v & 255] << 8];
+
+    for (int32_t i = 0; i < count; i++, u += step) {
+      texels[i] = row[sampler.window_u[u & 255]];
+    }
+
+    return;
+  }
+
+  for (int32_t i = 0; i < count; i++, u += step) {
+    texels[i] = get_texel<flags>(sampler, { u, v });
   }
+}
+
+
+// The rectangle has been clipped to the drawing area (or a tile) by the
+// time it gets here, so whole rows are written without checking each pixel.
+// Rectangles are never dithered.
 
-  color_t pixel = get_texture_color(tev, coord);
+template<uint32_t flags>
+void gpu_t::draw_rectangle(rectangle_t &rectangle) {
+  const int32_t width = rectangle.size.x;
+  const uint16_t set = get_mask_set();
+  const uint16_t check = get_mask_check();
 
-  if (blended) {
-    color.r = std::min(255, (pixel.r * color.r) / 2);
-    color.g = std::min(255, (pixel.g * color.g) / 2);
-    color.b = std::min(255, (pixel.b * color.b) / 2);
+  if ((flags & (raster_textured | raster_blend)) == 0 && check == 0) {
+    uint16_t color = color_to_uint16(rectangle.color) | set;
+
+    for (int32_t y = 0; y < rectangle.size.y; y++) {
+      vram_fill_row(rectangle.point.x, rectangle.point.y + y, color, width);
+    }
+
+    if (stats != nullptr) {
+      uint64_t area = uint64_t(width) * rectangle.size.y;
+
+      stats->add_pixels(flags, area, area);
+    }
+
+    return;
   }
-  else {
-    color.r = pixel.r;
-    color.g = pixel.g;
-    color.b = pixel.b;
+
+  const int32_t step_x = rectangle.flip_x ? -1 : 1;
+  const int32_t step_y = rectangle.flip_y ? -1 : 1;
+
+  const sampler_t sampler = get_sampler(rectangle.tev);
+
+  uint16_t texels[1024];
+  uint16_t colors[1024];
+
+  if ((flags & raster_textured) == 0) {
+    std::fill(colors, colors + width, color_to_uint16(rectangle.color));
   }
 
-  return (color.r | color.g | color.b) > 0;
-}
+  // raw texels are written as they are
 
+  const uint16_t *source = (flags & raster_raw) ? texels : colors;
 
-void gpu_t::draw_rectangle() {
-  tev_t tev;
-  tev.palette_page_x = (fifo.buffer[2] >> 12) & 0x3f0;
-  tev.palette_page_y = (fifo.buffer[2] >> 22) & 0x1ff;
-  tev.texture_page_x = (status << 6) & 0x3c0;
-  tev.texture_page_y = (status << 4) & 0x100;
-  tev.texture_colors = (status >> 7) & 3;
-
-  color_t color;
-  color.r = (fifo.buffer[0] >> (0 * 8)) & 0xff;
-  color.g = (fifo.buffer[0] >> (1 * 8)) & 0xff;
-  color.b = (fifo.buffer[0] >> (2 * 8)) & 0xff;
-
-  point_t tex_coord;
-  tex_coord.x = (fifo.buffer[2] >> 0) & 0xff;
-  tex_coord.y = (fifo.buffer[2] >> 8) & 0xff;
-
-  int32_t xofs = x_offset + int16_t(fifo.buffer[1]);
-  int32_t yofs = y_offset + int16_t(fifo.buffer[1] >> 16);
-
-  int32_t w = get_x_length(fifo.buffer);
-  int32_t h = get_y_length(fifo.buffer);
-
-  for (int32_t y = 0; y < h; y++) {
-    for (int32_t x = 0; x < w; x++) {
-      point_t coord;
-      coord.x = tex_coord.x + x;
-      coord.y = tex_coord.y + y;
-
-      if (get_color(fifo.buffer[0], color, tev, coord)) {
-        point_t point;
-        point.x = xofs + x;
-        point.y = yofs + y;
-
-        draw_point(point, color);
+  uint64_t written = 0;
+
+  for (int32_t y = 0; y < rectangle.size.y; y++) {
+    const int32_t x = rectangle.point.x;
+
+    if (flags & raster_textured) {
+      get_texel_row<flags>(sampler, rectangle.coord.x, step_x, rectangle.coord.y + (y * step_y), texels, width);
+
+      if ((flags & raster_raw) == 0) {
+        for (int32_t i = 0; i < width; i++) {
+          colors[i] = color_to_uint16(shade_texel<flags>(texels[i], rectangle.color)) | (texels[i] & 0x8000);
+        }
       }
     }
+
+    // the drawing area can reach past the bottom of vram, rows wrap around
+
+    const int32_t row = (rectangle.point.y + y) & 511;
+
+    for (int32_t i = x & ~63; i < x + width; i += 64) {
+      texture_cache.invalidate(vram_address(i, row));
+    }
+
+    written += write_row<flags>(vram_data(x, row), source, texels, width, set, check);
+  }
+
+  if (stats != nullptr) {
+    stats->add_pixels(flags, uint64_t(width) * rectangle.size.y, written);
+  }
+}
+
+
+typedef void (gpu_t::*draw_rectangle_t)(gpu_t::rectangle_t &);
+
+
+// rectangles aren't dithered, those entries share the undithered code
+
+template<uint32_t flags>
+struct draw_rectangle_entry_t {
+  static draw_rectangle_t get() {
+    return &gpu_t::draw_rectangle<flags & ~gpu_t::raster_dither>;
   }
+};
+
+
+static draw_rectangle_t *get_draw_rectangle_table() {
+  static draw_rectangle_t table[256];
+
+  raster_table_t<draw_rectangle_t, draw_rectangle_entry_t>::fill(table);
+
+  return table;
+}
+
+
+void gpu_t::draw_rectangle(uint32_t flags, rectangle_t &rectangle) {
+  static draw_rectangle_t *table = get_draw_rectangle_table();
+
+  (this->*table[flags])(rectangle);
+}
+
+
+bool gpu_t::clip_rectangle(rectangle_t &rectangle, point_t min, point_t max) {
+  min.x = std::max(min.x, rectangle.point.x);
+  min.y = std::max(min.y, rectangle.point.y);
+  max.x = std::min(max.x, rectangle.point.x + rectangle.size.x - 1);
+  max.y = std::min(max.y, rectangle.point.y + rectangle.size.y - 1);
+
+  if (min.x > max.x || min.y > max.y) {
+    return false;
+  }
+
+  int32_t dx = min.x - rectangle.point.x;
+  int32_t dy = min.y - rectangle.point.y;
+
+  rectangle.coord.x += rectangle.flip_x ? -dx : dx;
+  rectangle.coord.y += rectangle.flip_y ? -dy : dy;
+  rectangle.point = min;
+  rectangle.size.x = max.x - min.x + 1;
+  rectangle.size.y = max.y - min.y + 1;
+
+  return true;
+}
+
+
+void gpu_t::draw_rectangle() {
+  uint32_t command = fifo.buffer[0];
+
+  rectangle_t rectangle;
+  rectangle.tev.palette_page_x = (fifo.buffer[2] >> 12) & 0x3f0;
+  rectangle.tev.palette_page_y = (fifo.buffer[2] >> 22) & 0x1ff;
+  rectangle.tev.texture_page_x = (status << 6) & 0x3c0;
+  rectangle.tev.texture_page_y = (status << 4) & 0x100;
+  rectangle.tev.texture_colors = (status >> 7) & 3;
+  rectangle.tev.color_mix_mode = (status >> 5) & 3;
+  rectangle.tev.texels = nullptr;
+
+  rectangle.color.r = (command >> (0 * 8)) & 0xff;
+  rectangle.color.g = (command >> (1 * 8)) & 0xff;
+  rectangle.color.b = (command >> (2 * 8)) & 0xff;
+
+  rectangle.coord.x = (fifo.buffer[2] >> 0) & 0xff;
+  rectangle.coord.y = (fifo.buffer[2] >> 8) & 0xff;
+
+  rectangle.point.x = x_offset + int16_t(fifo.buffer[1]);
+  rectangle.point.y = y_offset + int16_t(fifo.buffer[1] >> 16);
+
+  rectangle.size.x = get_x_length(fifo.buffer);
+  rectangle.size.y = get_y_length(fifo.buffer);
+
+  rectangle.flip_x = textured_rectangle_x_flip;
+  rectangle.flip_y = textured_rectangle_y_flip;
+
+  point_t min = { drawing_area_x1, drawing_area_y1 };
+  point_t max = { drawing_area_x2, drawing_area_y2 };
+
+  if (clip_rectangle(rectangle, min, max) == false) {
+    return;
+  }
+
+  uint32_t flags = get_raster_flags(command, rectangle.tev, false);
+
+  if (tiles != nullptr) {
+    return tiles->push(flags, rectangle);
+  }
+
+  if (flags & raster_textured) {
+    max.x = rectangle.point.x + rectangle.size.x - 1;
+    max.y = rectangle.point.y + rectangle.size.y - 1;
+
+    bind_texture(rectangle.tev, rectangle.point, max);
+  }
+
+  draw_rectangle(flags, rectangle);
 }
@@ -0,0 +1,121 @@
+#include "gpu/gpu-stats.hpp"
+
+#include <cstdio>
+#include "gpu/gpu.hpp"
+
+
+static const char *class_names[gpu_stats_t::class_count] = {
+  "polygon",
+  "line",
+  "rectangle",
+  "fill",
+  "copy",
+  "upload",
+  "download",
+  "state",
+  "flush"
+};
+
+
+gpu_stats_t::gpu_stats_t() {
+  reset();
+}
+
+
+void gpu_stats_t::reset() {
+  for (auto &c : classes) {
+    c.commands = 0;
+    c.nanoseconds = 0;
+  }
+
+  pixels_tested = 0;
+  pixels_written = 0;
+  pixels_textured = 0;
+  pixels_untextured = 0;
+  pixels_blended = 0;
+
+  frames = 0;
+}
+
+
+int gpu_stats_t::get_class(uint32_t command) {
+  switch (command & 0xe0) {
+    case 0x20: return polygon;
+    case 0x40: return line;
+    case 0x60: return rectangle;
+    case 0x80: return copy;
+    case 0xa0: return upload;
+    case 0xc0: return download;
+  }
+
+  if (command == 0x02) {
+    return fill;
+  }
+
+  return state;
+}
+
+
+void gpu_stats_t::add_command(int index) {
+  classes[index].commands.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+void gpu_stats_t::add_time(int index, std::chrono::steady_clock::duration time) {
+  uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+
+  classes[index].nanoseconds.fetch_add(ns, std::memory_order_relaxed);
+}
+
+
+void gpu_stats_t::add_pixels(uint32_t flags, uint64_t tested, uint64_t written) {
+  pixels_tested.fetch_add(tested, std::memory_order_relaxed);
+  pixels_written.fetch_add(written, std::memory_order_relaxed);
+
+  if (flags & gpu_t::raster_textured) {
+    pixels_textured.fetch_add(written, std::memory_order_relaxed);
+  }
+  else {
+    pixels_untextured.fetch_add(written, std::memory_order_relaxed);
+  }
+
+  if (flags & gpu_t::raster_blend) {
+    pixels_blended.fetch_add(written, std::memory_order_relaxed);
+  }
+}
+
+
+void gpu_stats_t::print() {
+  double per_frame = frames ? 1.0 / frames : 1.0;
+
+  printf("gpu: %u frames\n", frames);
+  printf("  %-10s %12s %10s %12s\n", "class", "commands", "per frame", "ms per frame");
+
+  for (int i = 0; i < class_count; i++) {
+    uint64_t commands = classes[i].commands;
+    uint64_t ns = classes[i].nanoseconds;
+
+    if (commands == 0 && ns == 0) {
+      continue;
+    }
+
+    printf("  %-10s %12llu %10.1f %12.3f\n",
+      class_names[i],
+      (unsigned long long)commands,
+      commands * per_frame,
+      (ns / 1e6) * per_frame);
+  }
+
+  uint64_t tested = pixels_tested;
+  uint64_t written = pixels_written;
+
+  printf("  pixels per frame: %.0f tested, %.0f written (%.1f%%)\n",
+    tested * per_frame,
+    written * per_frame,
+    tested ? (100.0 * written) / tested : 0.0);
+
+  printf("  written pixels per frame: %.0f textured, %.0f untextured, %.0f semi-transparent\n",
+    pixels_textured * per_frame,
+    pixels_untextured * per_frame,
+    pixels_blended * per_frame);
+}
@@ -0,0 +1,101 @@
+#ifndef __psxact_gpu_stats__
+#define __psxact_gpu_stats__
+
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+
+// Counts what the GPU is asked to do, and how long it takes, so the slow
+// paths of a game can be found. Nothing is counted unless gpu_t has one of
+// these, see gpu_t::enable_stats.
+//
+// Pixels are added once per primitive (or per tile of one), from whichever
+// thread draws it.
+
+class gpu_stats_t {
+
+public:
+
+  enum {
+    polygon,
+    line,
+    rectangle,
+    fill,
+    copy,
+    upload,
+    download,
+    state,
+    flush,
+    class_count
+  };
+
+  struct class_t {
+
+    std::atomic<uint64_t> commands;
+    std::atomic<uint64_t> nanoseconds;
+
+  };
+
+  // adds the time until it goes out of scope to a class, if there are stats
+  // to add it to.
+
+  class timer_t {
+
+    gpu_stats_t *stats;
+    int index;
+    std::chrono::steady_clock::time_point start;
+
+  public:
+
+    timer_t(gpu_stats_t *stats, int index)
+      : stats(stats)
+      , index(index) {
+
+      if (stats != nullptr) {
+        start = std::chrono::steady_clock::now();
+      }
+    }
+
+    ~timer_t() {
+      if (stats != nullptr) {
+        stats->add_time(index, std::chrono::steady_clock::now() - start);
+      }
+    }
+
+  };
+
+  class_t classes[class_count];
+
+  std::atomic<uint64_t> pixels_tested;
+  std::atomic<uint64_t> pixels_written;
+  std::atomic<uint64_t> pixels_textured;
+  std::atomic<uint64_t> pixels_untextured;
+  std::atomic<uint64_t> pixels_blended;
+
+  uint32_t frames;
+
+  gpu_stats_t();
+
+  void reset();
+
+  static int get_class(uint32_t command);
+
+  void add_command(int index);
+
+  void add_time(int index, std::chrono::steady_clock::duration time);
+
+  // 'tested' are the pixels a primitive looked at, 'written' the ones that
+  // weren't outside it or transparent. 'flags' are its raster flags.
+
+  void add_pixels(uint32_t flags, uint64_t tested, uint64_t written);
+
+  // prints everything counted since the last reset
+
+  void print();
+
+};
+
+
+#endif // __psxact_gpu_stats__
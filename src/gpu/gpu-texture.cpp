@@ -0,0 +1,157 @@
+#include "gpu/gpu-texture.hpp"
+
+#include "gpu/gpu.hpp"
+
+
+gpu_texture_cache_t::gpu_texture_cache_t()
+  : clock(0)
+  , pinned(0)
+  , pinning(false) {
+
+  clear();
+}
+
+
+void gpu_texture_cache_t::clear() {
+  for (auto &entry : entries) {
+    entry.valid = false;
+  }
+
+  for (auto &block : blocks) {
+    block = 0;
+  }
+}
+
+
+void gpu_texture_cache_t::set_pinning(bool enable) {
+  pinning = enable;
+  pinned = 0;
+}
+
+
+void gpu_texture_cache_t::unpin() {
+  pinned = 0;
+}
+
+
+const uint16_t *gpu_texture_cache_t::lookup(gpu_t &gpu, int32_t depth, int32_t page_x, int32_t page_y, int32_t palette_x, int32_t palette_y) {
+  uint32_t key =
+    (depth << 20) |
+    ((page_x >> 6) << 16) |
+    ((page_y >> 8) << 15) |
+    ((palette_x >> 4) << 9) |
+    (palette_y);
+
+  int victim = -1;
+
+  for (int i = 0; i < entry_count; i++) {
+    entry_t &entry = entries[i];
+
+    if (entry.valid && entry.key == key) {
+      entry.last_used = ++clock;
+
+      if (pinning) {
+        pinned |= 1 << i;
+      }
+
+      return entry.texels.data();
+    }
+
+    if (pinned & (1 << i)) {
+      continue;
+    }
+
+    if (victim == -1 || (entries[victim].valid && (entry.valid == false || entry.last_used < entries[victim].last_used))) {
+      victim = i;
+    }
+  }
+
+  // everything is pinned, the caller reads VRAM instead
+
+  if (victim == -1) {
+    return nullptr;
+  }
+
+  entry_t &entry = entries[victim];
+
+  if (entry.valid) {
+    invalidate_mask(1 << victim);
+  }
+
+  decode(gpu, entry, depth, page_x, page_y, palette_x, palette_y);
+
+  entry.valid = true;
+  entry.key = key;
+  entry.last_used = ++clock;
+
+  if (pinning) {
+    pinned |= 1 << victim;
+  }
+
+  // 4bpp pages are 64 halfwords wide, 8bpp pages are 128.
+
+  mark(gpu, victim, page_x, page_y, depth ? 128 : 64, 256);
+  mark(gpu, victim, palette_x, palette_y, depth ? 256 : 16, 1);
+
+  return entry.texels.data();
+}
+
+
+void gpu_texture_cache_t::invalidate_mask(uint32_t mask) {
+  for (int i = 0; i < entry_count; i++) {
+    if (mask & (1 << i)) {
+      entries[i].valid = false;
+    }
+  }
+
+  for (auto &block : blocks) {
+    block &= ~mask;
+  }
+}
+
+
+void gpu_texture_cache_t::mark(gpu_t &gpu, int index, int32_t x, int32_t y, int32_t w, int32_t h) {
+  // pages and CLUTs are aligned to 16 halfwords, stepping by 16 visits every
+  // block they touch. areas running off the right edge carry on at the
+  // start of the next row, same as the reads.
+
+  for (int32_t row = 0; row < h; row++) {
+    for (int32_t column = 0; column < w; column += 16) {
+      blocks[get_block(gpu.vram_address(x + column, y + row))] |= 1 << index;
+    }
+  }
+}
+
+
+void gpu_texture_cache_t::decode(gpu_t &gpu, entry_t &entry, int32_t depth, int32_t page_x, int32_t page_y, int32_t palette_x, int32_t palette_y) {
+  uint16_t palette[256];
+
+  for (int32_t i = 0; i < (depth ? 256 : 16); i++) {
+    palette[i] = gpu.vram_read(palette_x + i, palette_y);
+  }
+
+  entry.texels.resize(256 * 256);
+
+  uint16_t *texels = entry.texels.data();
+
+  for (int32_t v = 0; v < 256; v++) {
+    if (depth) {
+      for (int32_t u = 0; u < 256; u += 2) {
+        uint16_t data = gpu.vram_read(page_x + (u / 2), page_y + v);
+
+        *texels++ = palette[(data >> 0) & 255];
+        *texels++ = palette[(data >> 8) & 255];
+      }
+    }
+    else {
+      for (int32_t u = 0; u < 256; u += 4) {
+        uint16_t data = gpu.vram_read(page_x + (u / 4), page_y + v);
+
+        *texels++ = palette[(data >>  0) & 15];
+        *texels++ = palette[(data >>  4) & 15];
+        *texels++ = palette[(data >>  8) & 15];
+        *texels++ = palette[(data >> 12) & 15];
+      }
+    }
+  }
+}
@@ -0,0 +1,79 @@
+#ifndef __psxact_gpu_texture__
+#define __psxact_gpu_texture__
+
+
+#include <cstdint>
+#include <vector>
+
+
+class gpu_t;
+
+
+// Keeps 4bpp and 8bpp texture pages already run through their CLUT, so a
+// texel is a single load instead of two VRAM reads.
+//
+// VRAM is split into blocks of 64x16 halfwords, and each block has a mask
+// of the entries that were decoded from it. Writes only have to look at the
+// mask of the block they land in, which is almost always empty.
+
+class gpu_texture_cache_t {
+
+  static const int entry_count = 16;
+  static const int block_count = 16 * 32;
+
+  struct entry_t {
+    bool valid;
+    uint32_t key;
+    uint32_t last_used;
+    std::vector<uint16_t> texels;
+  };
+
+  entry_t entries[entry_count];
+  uint16_t blocks[block_count];
+  uint32_t clock;
+  uint32_t pinned;
+  bool pinning;
+
+public:
+
+  gpu_texture_cache_t();
+
+  // returns the 256x256 decoded texels of a page, with the given CLUT
+
+  const uint16_t *lookup(gpu_t &gpu, int32_t depth, int32_t page_x, int32_t page_y, int32_t palette_x, int32_t palette_y);
+
+  void invalidate(uint32_t address) {
+    uint32_t mask = blocks[get_block(address)];
+
+    if (mask) {
+      invalidate_mask(mask);
+    }
+  }
+
+  void clear();
+
+  // while pinning, entries that have been handed out aren't replaced until
+  // they're unpinned. the tile renderer holds on to them until it flushes.
+
+  void set_pinning(bool enable);
+
+  void unpin();
+
+private:
+
+  static uint32_t get_block(uint32_t address) {
+    uint32_t index = (address & 0xfffff) / 2;
+
+    return ((index >> 14) << 4) | ((index >> 6) & 15);
+  }
+
+  void invalidate_mask(uint32_t mask);
+
+  void mark(gpu_t &gpu, int index, int32_t x, int32_t y, int32_t w, int32_t h);
+
+  void decode(gpu_t &gpu, entry_t &entry, int32_t depth, int32_t page_x, int32_t page_y, int32_t palette_x, int32_t palette_y);
+
+};
+
+
+#endif // __psxact_gpu_texture__
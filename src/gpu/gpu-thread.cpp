@@ -0,0 +1,193 @@
+#include "gpu/gpu-thread.hpp"
+
+#include "gpu/gpu.hpp"
+
+
+// how long the render thread polls an empty ring before going to sleep,
+// commands tend to arrive in bursts.
+
+static const int SPIN_COUNT = 4096;
+
+
+gpu_thread_t::gpu_thread_t(gpu_t *gpu)
+  : gpu(gpu)
+  , ring_rd(0)
+  , ring_wr(0)
+  , sleeping(false)
+  , running(true) {
+
+  reset();
+
+  thread = std::thread(&gpu_thread_t::run, this);
+}
+
+
+gpu_thread_t::~gpu_thread_t() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    running = false;
+  }
+
+  wake.notify_one();
+  thread.join();
+}
+
+
+void gpu_thread_t::write(uint32_t port, uint32_t data) {
+  if (port == GPU_GP0) {
+    track_gp0(data);
+  }
+  else {
+    track_gp1(data);
+  }
+
+  uint32_t wr = ring_wr.load(std::memory_order_relaxed);
+
+  while (wr - ring_rd.load(std::memory_order_acquire) == ring_size) {
+    std::this_thread::yield();
+  }
+
+  ring[wr & ring_mask].port = port;
+  ring[wr & ring_mask].data = data;
+
+  ring_wr.store(wr + 1);
+
+  if (sleeping.load()) {
+    std::lock_guard<std::mutex> lock(mutex);
+    wake.notify_one();
+  }
+}
+
+
+void gpu_thread_t::sync() {
+  uint32_t wr = ring_wr.load(std::memory_order_relaxed);
+
+  while (ring_rd.load(std::memory_order_acquire) != wr) {
+    std::this_thread::yield();
+  }
+}
+
+
+void gpu_thread_t::reset() {
+  // only valid while the ring is empty, the front end picks up wherever the
+  // render thread is.
+
+  auto &transfer = gpu->cpu_to_gpu_transfer;
+
+  front.status = gpu->status;
+  front.command = gpu->fifo.buffer[0];
+  front.size = gpu->fifo.buffer[2];
+  front.index = gpu->fifo.wr;
+  front.transfer = 0;
+  front.polyline = gpu->polyline.active;
+
+  if (transfer.run.active) {
+    front.transfer =
+      (transfer.reg.w * transfer.reg.h) -
+      (transfer.reg.w * transfer.run.y) - transfer.run.x;
+  }
+}
+
+
+uint32_t gpu_thread_t::get_status() const {
+  return front.status;
+}
+
+
+void gpu_thread_t::track_gp0(uint32_t data) {
+  // transfers move two pixels per word, the last half of an odd transfer is
+  // dropped.
+
+  if (front.transfer) {
+    front.transfer = (front.transfer > 2) ? (front.transfer - 2) : 0;
+    return;
+  }
+
+  if (front.polyline) {
+    front.polyline = gpu_t::is_polyline_end(data) == false;
+    return;
+  }
+
+  if (front.index == 0) {
+    front.command = data;
+  }
+
+  if (front.index == 2) {
+    front.size = data;
+  }
+
+  front.index++;
+
+  uint32_t command = front.command >> 24;
+
+  if (front.index == gpu_t::get_command_size(command)) {
+    front.index = 0;
+
+    if ((command & 0xe0) == 0xa0) {
+      uint32_t w = ((front.size - 1) & 0x3ff) + 1;
+      uint32_t h = (((front.size >> 16) - 1) & 0x1ff) + 1;
+
+      front.transfer = w * h;
+    }
+
+    if ((command & 0xe8) == 0x48) {
+      front.polyline = true;
+    }
+
+    front.status = gpu_t::gp0_status(front.status, front.command);
+  }
+}
+
+
+void gpu_thread_t::track_gp1(uint32_t data) {
+  if (((data >> 24) & 0x3f) == 0x01) {
+    front.index = 0;
+    front.polyline = false;
+  }
+
+  front.status = gpu_t::gp1_status(front.status, data);
+}
+
+
+void gpu_thread_t::run() {
+  while (true) {
+    uint32_t rd = ring_rd.load(std::memory_order_relaxed);
+
+    for (int i = 0; i < SPIN_COUNT && ring_wr.load(std::memory_order_acquire) == rd; i++) {
+      std::this_thread::yield();
+    }
+
+    if (ring_wr.load(std::memory_order_acquire) == rd) {
+      std::unique_lock<std::mutex> lock(mutex);
+      sleeping = true;
+
+      wake.wait(lock, [&]() {
+        return ring_wr.load() != rd || running == false;
+      });
+
+      sleeping = false;
+
+      if (ring_wr.load() == rd) {
+        return;
+      }
+    }
+
+    // drain everything that's there, the cpu thread only waits on the
+    // read pointer.
+
+    uint32_t wr = ring_wr.load(std::memory_order_acquire);
+
+    for (; rd != wr; rd++) {
+      const entry_t &entry = ring[rd & ring_mask];
+
+      if (entry.port == GPU_GP0) {
+        gpu->gp0(entry.data);
+      }
+      else {
+        gpu->gp1(entry.data);
+      }
+
+      ring_rd.store(rd + 1, std::memory_order_release);
+    }
+  }
+}
@@ -0,0 +1,80 @@
+#ifndef __psxact_gpu_thread__
+#define __psxact_gpu_thread__
+
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+
+class gpu_t;
+
+
+// Runs GP0/GP1 writes on a render thread of their own. The cpu thread puts
+// them in a single-producer/single-consumer ring, and only waits for the
+// render thread to catch up when it needs to look at VRAM.
+
+class gpu_thread_t {
+
+  static const uint32_t ring_size = 1 << 16;
+  static const uint32_t ring_mask = ring_size - 1;
+
+  struct entry_t {
+    uint32_t port;
+    uint32_t data;
+  };
+
+  gpu_t *gpu;
+
+  entry_t ring[ring_size];
+  std::atomic<uint32_t> ring_rd;
+  std::atomic<uint32_t> ring_wr;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::atomic<bool> sleeping;
+  std::atomic<bool> running;
+  std::thread thread;
+
+  // the cpu thread follows the command stream just far enough to know where
+  // each command starts, so GPUSTAT can be answered without waiting.
+
+  struct {
+
+    uint32_t status;
+    uint32_t command;
+    uint32_t size;
+    int32_t index;
+    uint32_t transfer;
+    bool polyline;
+
+  } front;
+
+public:
+
+  gpu_thread_t(gpu_t *gpu);
+
+  ~gpu_thread_t();
+
+  void write(uint32_t port, uint32_t data);
+
+  void sync();
+
+  void reset();
+
+  uint32_t get_status() const;
+
+private:
+
+  void track_gp0(uint32_t data);
+
+  void track_gp1(uint32_t data);
+
+  void run();
+
+};
+
+
+#endif // __psxact_gpu_thread__
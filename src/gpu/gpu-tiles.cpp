@@ -0,0 +1,373 @@
+#include "gpu/gpu-tiles.hpp"
+
+#include <algorithm>
+#include "gpu/gpu-stats.hpp"
+
+
+// flushes anyway once this many primitives are waiting, so a game that
+// never reads anything back doesn't grow the list without bound.
+
+static const size_t MAX_PRIMITIVES = 16384;
+
+
+static int get_thread_count() {
+  return std::max(1, int(std::thread::hardware_concurrency()));
+}
+
+
+// calls 'visit' with every tile an area of VRAM touches, until it returns
+// true.
+
+template<typename visitor_t>
+static bool visit_area(int32_t x, int32_t y, int32_t w, int32_t h, visitor_t visit) {
+  if (x + w > 1024) {
+    // an area running off the right edge carries on at the start of the
+    // next row.
+
+    return
+      visit_area(x, y, 1024 - x, h, visit) ||
+      visit_area(0, y + 1, x + w - 1024, h, visit);
+  }
+
+  for (int32_t row = y / 32; row <= (y + h - 1) / 32; row++) {
+    for (int32_t column = x / 32; column <= (x + w - 1) / 32; column++) {
+      if (visit(((row & 15) * 32) + column)) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+
+template<typename visitor_t>
+static bool visit_texture(const gpu_t::tev_t &tev, visitor_t visit) {
+  static const int32_t page_width[4] = { 64, 128, 256, 256 };
+  static const int32_t clut_width[4] = { 16, 256, 0, 0 };
+
+  int32_t colors = tev.texture_colors;
+
+  if (visit_area(tev.texture_page_x, tev.texture_page_y, page_width[colors], 256, visit)) {
+    return true;
+  }
+
+  return
+    clut_width[colors] != 0 &&
+    visit_area(tev.palette_page_x, tev.palette_page_y, clut_width[colors], 1, visit);
+}
+
+
+gpu_tiles_t::gpu_tiles_t(gpu_t *gpu)
+  : gpu(gpu)
+  , queues(get_thread_count())
+  , remaining(0)
+  , generation(0)
+  , running(true) {
+
+  std::fill(written, written + tile_count, false);
+  std::fill(sampled, sampled + tile_count, false);
+
+  gpu->texture_cache.set_pinning(true);
+
+  for (int i = 1; i < int(queues.size()); i++) {
+    workers.push_back(std::thread(&gpu_tiles_t::run, this, i));
+  }
+}
+
+
+gpu_tiles_t::~gpu_tiles_t() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    running = false;
+  }
+
+  wake.notify_all();
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  gpu->texture_cache.set_pinning(false);
+}
+
+
+bool gpu_tiles_t::can_defer(uint32_t command) {
+  switch (command & 0xe0) {
+    case 0x20: // polygons
+    case 0x60: // rectangles
+      return true;
+  }
+
+  switch (command) {
+    case 0x00: // nop
+    case 0x01: // clear texture cache
+    case 0xe1: // texpage, picked up when a primitive is pushed
+    case 0xe5: // drawing offset, same
+      return true;
+  }
+
+  return false;
+}
+
+
+void gpu_tiles_t::push(uint32_t flags, gpu_t::triangle_t &triangle) {
+  if (prepare(flags, triangle.tev, triangle.min, triangle.max) == false) {
+    return gpu->draw_triangle(flags, triangle);
+  }
+
+  primitive_t primitive;
+  primitive.flags = flags;
+  primitive.rectangle = false;
+  primitive.triangle = triangle;
+
+  add(primitive, triangle.min, triangle.max);
+}
+
+
+void gpu_tiles_t::push(uint32_t flags, gpu_t::rectangle_t &rectangle) {
+  gpu_t::point_t min = rectangle.point;
+  gpu_t::point_t max;
+  max.x = rectangle.point.x + rectangle.size.x - 1;
+  max.y = rectangle.point.y + rectangle.size.y - 1;
+
+  if (prepare(flags, rectangle.tev, min, max) == false) {
+    return gpu->draw_rectangle(flags, rectangle);
+  }
+
+  primitive_t primitive;
+  primitive.flags = flags;
+  primitive.rectangle = true;
+  primitive.rect = rectangle;
+
+  add(primitive, min, max);
+}
+
+
+bool gpu_tiles_t::prepare(uint32_t flags, gpu_t::tev_t &tev, gpu_t::point_t min, gpu_t::point_t max) {
+  bool textured = (flags & gpu_t::raster_textured) != 0;
+
+  // tiles are laid out over VRAM, and the drawing area goes past the bottom
+  // of it. those primitives, and ones that read what they draw, are drawn
+  // on the spot.
+
+  if (max.y > 511 || (textured && gpu_t::samples_target(tev, min, max))) {
+    flush();
+
+    if (textured) {
+      gpu->bind_texture(tev, min, max);
+    }
+
+    return false;
+  }
+
+  if (textured && visit_texture(tev, [&](int tile) { return written[tile]; })) {
+    flush();
+  }
+
+  if (visit_area(min.x, min.y, max.x - min.x + 1, max.y - min.y + 1, [&](int tile) { return sampled[tile]; })) {
+    flush();
+  }
+
+  if (textured) {
+    gpu->bind_texture(tev, min, max);
+
+    visit_texture(tev, [&](int tile) {
+      sampled[tile] = true;
+      return false;
+    });
+  }
+
+  return true;
+}
+
+
+void gpu_tiles_t::add(const primitive_t &primitive, gpu_t::point_t min, gpu_t::point_t max) {
+  uint32_t index = uint32_t(primitives.size());
+
+  primitives.push_back(primitive);
+
+  for (int32_t row = min.y / tile_size; row <= max.y / tile_size; row++) {
+    for (int32_t column = min.x / tile_size; column <= max.x / tile_size; column++) {
+      int tile = (row * tile_columns) + column;
+
+      bins[tile].push_back(index);
+      written[tile] = true;
+    }
+  }
+
+  if (primitives.size() == MAX_PRIMITIVES) {
+    flush();
+  }
+}
+
+
+void gpu_tiles_t::flush() {
+  if (primitives.empty()) {
+    return;
+  }
+
+  if (gpu->stats != nullptr) {
+    gpu->stats->add_command(gpu_stats_t::flush);
+  }
+
+  gpu_stats_t::timer_t timer(gpu->stats, gpu_stats_t::flush);
+
+  // cached textures under the tiles are dropped up front. that leaves the
+  // texture cache alone while the tiles are drawn, so the workers don't
+  // have to agree on who updates it.
+
+  std::vector<uint32_t> tiles;
+
+  for (int tile = 0; tile < tile_count; tile++) {
+    if (bins[tile].empty()) {
+      continue;
+    }
+
+    int32_t x = (tile % tile_columns) * tile_size;
+    int32_t y = (tile / tile_columns) * tile_size;
+
+    for (int32_t row = 0; row < tile_size; row += 16) {
+      gpu->texture_cache.invalidate(gpu->vram_address(x, y + row));
+    }
+
+    tiles.push_back(tile);
+  }
+
+  // a worker still on its way out of the last flush can pick up a tile as
+  // soon as it's queued, so the count has to be there first.
+
+  remaining = int(tiles.size());
+
+  for (size_t i = 0; i < tiles.size(); i++) {
+    queue_t &queue = queues[i % queues.size()];
+
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tiles.push_back(tiles[i]);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    generation++;
+  }
+
+  wake.notify_all();
+
+  work(0);
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    done.wait(lock, [&]() {
+      return remaining == 0;
+    });
+  }
+
+  for (auto &bin : bins) {
+    bin.clear();
+  }
+
+  std::fill(written, written + tile_count, false);
+  std::fill(sampled, sampled + tile_count, false);
+
+  primitives.clear();
+
+  gpu->texture_cache.unpin();
+}
+
+
+bool gpu_tiles_t::take(int index, uint32_t &tile) {
+  int count = int(queues.size());
+
+  for (int i = 0; i < count; i++) {
+    queue_t &queue = queues[(index + i) % count];
+
+    std::lock_guard<std::mutex> lock(queue.mutex);
+
+    if (queue.tiles.empty()) {
+      continue;
+    }
+
+    // work from the front of our own queue, steal from the back of others
+
+    if (i == 0) {
+      tile = queue.tiles.front();
+      queue.tiles.pop_front();
+    }
+    else {
+      tile = queue.tiles.back();
+      queue.tiles.pop_back();
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+
+void gpu_tiles_t::work(int index) {
+  uint32_t tile;
+
+  while (take(index, tile)) {
+    draw_tile(tile);
+
+    if (remaining.fetch_sub(1) == 1) {
+      std::lock_guard<std::mutex> lock(mutex);
+      done.notify_all();
+    }
+  }
+}
+
+
+void gpu_tiles_t::draw_tile(uint32_t tile) {
+  gpu_t::point_t min;
+  min.x = (tile % tile_columns) * tile_size;
+  min.y = (tile / tile_columns) * tile_size;
+
+  gpu_t::point_t max;
+  max.x = min.x + tile_size - 1;
+  max.y = min.y + tile_size - 1;
+
+  for (uint32_t index : bins[tile]) {
+    const primitive_t &primitive = primitives[index];
+
+    if (primitive.rectangle) {
+      gpu_t::rectangle_t rectangle = primitive.rect;
+
+      if (gpu_t::clip_rectangle(rectangle, min, max)) {
+        gpu->draw_rectangle(primitive.flags, rectangle);
+      }
+    }
+    else {
+      gpu_t::triangle_t triangle = primitive.triangle;
+
+      if (gpu_t::clip_triangle(triangle, min, max)) {
+        gpu->draw_triangle(primitive.flags, triangle);
+      }
+    }
+  }
+}
+
+
+void gpu_tiles_t::run(int index) {
+  uint32_t seen = 0;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      wake.wait(lock, [&]() {
+        return generation != seen || running == false;
+      });
+
+      if (running == false) {
+        return;
+      }
+
+      seen = generation;
+    }
+
+    work(index);
+  }
+}
@@ -0,0 +1,94 @@
+#ifndef __psxact_gpu_tiles__
+#define __psxact_gpu_tiles__
+
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "gpu/gpu.hpp"
+
+
+// Holds on to triangles and rectangles, sorted into 32x32 tiles of VRAM,
+// and draws the tiles in parallel when something needs to see the result.
+// Each tile draws its primitives in order, so the output is the same as
+// drawing them one at a time.
+//
+// Anything that can see a half finished tile has to flush first: commands
+// other than drawing, texture reads from a tile that's waiting to be drawn,
+// and drawing over a tile that a waiting primitive reads its texture from.
+
+class gpu_tiles_t {
+
+  static const int tile_size = 32;
+  static const int tile_columns = 1024 / tile_size;
+  static const int tile_rows = 512 / tile_size;
+  static const int tile_count = tile_columns * tile_rows;
+
+  struct primitive_t {
+    uint32_t flags;
+    bool rectangle;
+    gpu_t::triangle_t triangle;
+    gpu_t::rectangle_t rect;
+  };
+
+  struct queue_t {
+    std::mutex mutex;
+    std::deque<uint32_t> tiles;
+  };
+
+  gpu_t *gpu;
+
+  std::vector<primitive_t> primitives;
+  std::vector<uint32_t> bins[tile_count];
+  bool written[tile_count];
+  bool sampled[tile_count];
+
+  // one queue per thread, including the one that flushes. threads that run
+  // out of tiles take them from the back of the other queues.
+
+  std::vector<queue_t> queues;
+  std::vector<std::thread> workers;
+  std::atomic<int> remaining;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  uint32_t generation;
+  bool running;
+
+public:
+
+  gpu_tiles_t(gpu_t *gpu);
+
+  ~gpu_tiles_t();
+
+  static bool can_defer(uint32_t command);
+
+  void push(uint32_t flags, gpu_t::triangle_t &triangle);
+
+  void push(uint32_t flags, gpu_t::rectangle_t &rectangle);
+
+  void flush();
+
+private:
+
+  bool prepare(uint32_t flags, gpu_t::tev_t &tev, gpu_t::point_t min, gpu_t::point_t max);
+
+  void add(const primitive_t &primitive, gpu_t::point_t min, gpu_t::point_t max);
+
+  bool take(int index, uint32_t &tile);
+
+  void work(int index);
+
+  void draw_tile(uint32_t tile);
+
+  void run(int index);
+
+};
+
+
+#endif // __psxact_gpu_tiles__
@@ -1,5 +1,13 @@
 #include "gpu/gpu.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include "gpu/gpu-stats.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 
 uint16_t *gpu_t::vram_data(int x, int y) {
   return (uint16_t *)vram.get_pointer(vram_address(x, y));
@@ -17,55 +25,200 @@ uint16_t gpu_t::vram_read(int x, int y) {
 
 
 void gpu_t::vram_write(int x, int y, uint16_t data) {
-  vram.io_write_half(vram_address(x, y), data);
+  uint32_t address = vram_address(x, y);
+
+  texture_cache.invalidate(address);
+
+  vram.io_write_half(address, data);
 }
 
 
-uint16_t gpu_t::vram_transfer_read() {
-  auto &transfer = gpu_to_cpu_transfer;
-  if (!transfer.run.active) {
-    return 0;
+void gpu_t::vram_read_row(int x, int y, uint16_t *data, int count) {
+  // transfers wrap around at the right edge onto the same row
+
+  x &= 1023;
+  y &= 511;
+
+  while (count) {
+    int n = std::min(count, 1024 - x);
+
+    memcpy(data, vram_data(x, y), n * sizeof(uint16_t));
+
+    data += n;
+    count -= n;
+    x = 0;
   }
+}
 
-  uint16_t data = vram_read(
-      transfer.reg.x + transfer.run.x,
-      transfer.reg.y + transfer.run.y);
 
-  transfer.run.x++;
+void gpu_t::vram_write_row(int x, int y, const uint16_t *data, int count) {
+  x &= 1023;
+  y &= 511;
 
-  if (transfer.run.x == transfer.reg.w) {
-    transfer.run.x = 0;
-    transfer.run.y++;
+  while (count) {
+    int n = std::min(count, 1024 - x);
 
-    if (transfer.run.y == transfer.reg.h) {
-      transfer.run.y = 0;
-      transfer.run.active = false;
+    for (int i = x & ~63; i < x + n; i += 64) {
+      texture_cache.invalidate(vram_address(i, y));
     }
+
+    memcpy(vram_data(x, y), data, n * sizeof(uint16_t));
+
+    data += n;
+    count -= n;
+    x = 0;
   }
+}
 
-  return data;
+
+void gpu_t::vram_fill_row(int x, int y, uint16_t color, int count) {
+  x &= 1023;
+  y &= 511;
+
+  while (count) {
+    int n = std::min(count, 1024 - x);
+
+    for (int i = x & ~63; i < x + n; i += 64) {
+      texture_cache.invalidate(vram_address(i, y));
+    }
+
+    uint16_t *data = vram_data(x, y);
+    int i = 0;
+
+#if defined(__SSE2__) || defined(_M_X64)
+    __m128i colors = _mm_set1_epi16(int16_t(color));
+
+    for (; i + 8 <= n; i += 8) {
+      _mm_storeu_si128((__m128i *)&data[i], colors);
+    }
+#endif
+
+    for (; i < n; i++) {
+      data[i] = color;
+    }
+
+    count -= n;
+    x = 0;
+  }
 }
 
 
-void gpu_t::vram_transfer_write(uint16_t data) {
-  auto &transfer = cpu_to_gpu_transfer;
-  if (!transfer.run.active) {
+void gpu_t::apply_mask(uint16_t *data, const uint16_t *background, uint16_t mask, int count) {
+  // sets the mask bit on every pixel in 'data', then puts back the pixels
+  // of 'background' that have it set, if there is one.
+
+  if (mask == 0 && background == nullptr) {
     return;
   }
 
-  vram_write(
+  int i = 0;
+
+#if defined(__SSE2__) || defined(_M_X64)
+  __m128i bits = _mm_set1_epi16(int16_t(mask));
+
+  for (; i + 8 <= count; i += 8) {
+    __m128i pixels = _mm_or_si128(_mm_loadu_si128((const __m128i *)&data[i]), bits);
+
+    if (background != nullptr) {
+      __m128i old = _mm_loadu_si128((const __m128i *)&background[i]);
+      __m128i keep = _mm_srai_epi16(old, 15);
+
+      pixels = _mm_or_si128(
+        _mm_and_si128(keep, old),
+        _mm_andnot_si128(keep, pixels));
+    }
+
+    _mm_storeu_si128((__m128i *)&data[i], pixels);
+  }
+#endif
+
+  for (; i < count; i++) {
+    if (background != nullptr && (background[i] & 0x8000)) {
+      data[i] = background[i];
+    }
+    else {
+      data[i] |= mask;
+    }
+  }
+}
+
+
+// Transfers move whole rows at a time. Words are two pixels, lower half
+// first, and a row can end halfway through one.
+
+uint32_t gpu_t::vram_transfer_read(uint32_t *data, uint32_t count) {
+  auto &transfer = gpu_to_cpu_transfer;
+
+  gpu_stats_t::timer_t timer(transfer.run.active ? stats : nullptr, gpu_stats_t::download);
+
+  uint16_t *halves = (uint16_t *)data;
+  uint32_t total = count * 2;
+  uint32_t index = 0;
+
+  while (index < total && transfer.run.active) {
+    int n = int(std::min(uint32_t(transfer.reg.w - transfer.run.x), total - index));
+
+    vram_read_row(
       transfer.reg.x + transfer.run.x,
-      transfer.reg.y + transfer.run.y, uint16_t(data));
+      transfer.reg.y + transfer.run.y, &halves[index], n);
+
+    index += n;
 
-  transfer.run.x++;
+    transfer.run.x += n;
 
-  if (transfer.run.x == transfer.reg.w) {
-    transfer.run.x = 0;
-    transfer.run.y++;
+    if (transfer.run.x == transfer.reg.w) {
+      transfer.run.x = 0;
+      transfer.run.y++;
 
-    if (transfer.run.y == transfer.reg.h) {
-      transfer.run.y = 0;
-      transfer.run.active = false;
+      if (transfer.run.y == transfer.reg.h) {
+        transfer.run.y = 0;
+        transfer.run.active = false;
+      }
     }
   }
+
+  // the upper half of an odd transfer's last word reads as zero
+
+  if (index & 1) {
+    halves[index++] = 0;
+  }
+
+  return index / 2;
+}
+
+
+uint32_t gpu_t::vram_transfer_write(const uint32_t *data, uint32_t count) {
+  auto &transfer = cpu_to_gpu_transfer;
+
+  gpu_stats_t::timer_t timer(transfer.run.active ? stats : nullptr, gpu_stats_t::upload);
+
+  const uint16_t *halves = (const uint16_t *)data;
+  uint32_t total = count * 2;
+  uint32_t index = 0;
+
+  while (index < total && transfer.run.active) {
+    int n = int(std::min(uint32_t(transfer.reg.w - transfer.run.x), total - index));
+
+    vram_write_row(
+      transfer.reg.x + transfer.run.x,
+      transfer.reg.y + transfer.run.y, &halves[index], n);
+
+    index += n;
+
+    transfer.run.x += n;
+
+    if (transfer.run.x == transfer.reg.w) {
+      transfer.run.x = 0;
+      transfer.run.y++;
+
+      if (transfer.run.y == transfer.reg.h) {
+        transfer.run.y = 0;
+        transfer.run.active = false;
+      }
+    }
+  }
+
+  // the upper half of an odd transfer's last word is dropped
+
+  return (index + 1) / 2;
 }
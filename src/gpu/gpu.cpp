@@ -2,21 +2,138 @@
 
 #include <cassert>
 #include "console.hpp"
+#include "gpu/gpu-recorder.hpp"
+#include "gpu/gpu-stats.hpp"
+#include "gpu/gpu-thread.hpp"
+#include "gpu/gpu-tiles.hpp"
+#include "limits.hpp"
 #include "utility.hpp"
 
 
 gpu_t::gpu_t()
   : memory_component_t("gpu")
   , vram("vram") {
+  polyline.active = false;
+
+  texture_window_mask_x = 0;
+  texture_window_mask_y = 0;
+  texture_window_offset_x = 0;
+  texture_window_offset_y = 0;
+
+  update_texture_window();
+}
+
+
+gpu_t::~gpu_t() {
+  delete recorder;
+  delete thread;
+  delete tiles;
+  delete stats;
+}
+
+
+void gpu_t::serialize(state_t &state) {
+  sync();
+
+  vram.serialize(state);
+
+  state.io(data_latch);
+  state.io(status);
+  state.io(texture_window_mask_x);
+  state.io(texture_window_mask_y);
+  state.io(texture_window_offset_x);
+  state.io(texture_window_offset_y);
+  state.io(drawing_area_x1);
+  state.io(drawing_area_y1);
+  state.io(drawing_area_x2);
+  state.io(drawing_area_y2);
+  state.io(x_offset);
+  state.io(y_offset);
+  state.io(display_area_x);
+  state.io(display_area_y);
+  state.io(display_area_x1);
+  state.io(display_area_y1);
+  state.io(display_area_x2);
+  state.io(display_area_y2);
+  state.io(textured_rectangle_x_flip);
+  state.io(textured_rectangle_y_flip);
+  state.io(fifo);
+  state.io(cpu_to_gpu_transfer);
+  state.io(gpu_to_cpu_transfer);
+  state.io(polyline);
+
+  if (state.is_loading()) {
+    texture_cache.clear();
+    update_texture_window();
+  }
+
+  if (thread != nullptr && state.is_loading()) {
+    thread->reset();
+  }
+
+  if (recorder != nullptr && state.is_loading()) {
+    recorder->save_state(*this);
+  }
+}
+
+
+void gpu_t::enable_thread() {
+  if (thread == nullptr) {
+    thread = new gpu_thread_t(this);
+  }
+}
+
+
+void gpu_t::enable_tiles() {
+  if (tiles == nullptr) {
+    tiles = new gpu_tiles_t(this);
+  }
+}
+
+
+void gpu_t::enable_stats() {
+  if (stats == nullptr) {
+    stats = new gpu_stats_t();
+  }
+}
+
+
+bool gpu_t::start_recording(const char *file_name) {
+  stop_recording();
+
+  recorder = gpu_recorder_t::open(file_name);
+  if (recorder == nullptr) {
+    return false;
+  }
+
+  recorder->save_state(*this);
+
+  return true;
+}
+
+
+void gpu_t::stop_recording() {
+  delete recorder;
+  recorder = nullptr;
+}
+
+
+void gpu_t::sync() {
+  if (thread != nullptr) {
+    thread->sync();
+  }
+
+  if (tiles != nullptr) {
+    tiles->flush();
+  }
 }
 
 
 uint32_t gpu_t::data() {
-  if (gpu_to_cpu_transfer.run.active) {
-    uint16_t lower = vram_transfer_read();
-    uint16_t upper = vram_transfer_read();
+  uint32_t value;
 
-    return (upper << 16) | lower;
+  if (vram_transfer_read(&value, 1)) {
+    return value;
   }
 
   return data_latch;
@@ -29,13 +146,23 @@ uint32_t gpu_t::stat() {
   //  27    Ready to send VRAM to CPU   (0=No, 1=Ready)  ;GP0(C0h) ;via GPUREAD
   //  28    Ready to receive DMA Block  (0=No, 1=Ready)  ;GP0(...) ;via GP0
 
-  return (status & ~0x00080000) | 0x1c002000;
+  uint32_t value = (thread != nullptr)
+    ? thread->get_status()
+    : status
+    ;
+
+  return (value & ~0x00080000) | 0x1c002000;
 }
 
 
 uint32_t gpu_t::io_read_word(uint32_t address) {
   switch (address) {
     case GPU_READ:
+      if (recorder != nullptr) {
+        recorder->read(1);
+      }
+
+      sync();
       return data();
 
     case GPU_STAT:
@@ -47,6 +174,19 @@ uint32_t gpu_t::io_read_word(uint32_t address) {
 
 
 void gpu_t::io_write_word(uint32_t address, uint32_t data) {
+  if (recorder != nullptr) {
+    recorder->write(address, &data, 1);
+  }
+
+  write_port(address, data);
+}
+
+
+void gpu_t::write_port(uint32_t address, uint32_t data) {
+  if (thread != nullptr) {
+    return thread->write(address, data);
+  }
+
   switch (address) {
     case GPU_GP0:
       return gp0(data);
@@ -57,79 +197,211 @@ void gpu_t::io_write_word(uint32_t address, uint32_t data) {
 }
 
 
+void gpu_t::io_read_words(uint32_t address, uint32_t *data, uint32_t count) {
+  if (address != GPU_READ) {
+    for (uint32_t i = 0; i < count; i++) {
+      data[i] = io_read_word(address);
+    }
+
+    return;
+  }
+
+  if (recorder != nullptr) {
+    recorder->read(count);
+  }
+
+  sync();
+
+  uint32_t n = vram_transfer_read(data, count);
+
+  for (uint32_t i = n; i < count; i++) {
+    data[i] = data_latch;
+  }
+}
+
+
+void gpu_t::io_write_words(uint32_t address, const uint32_t *data, uint32_t count) {
+  if (recorder != nullptr) {
+    recorder->write(address, data, count);
+  }
+
+  if (thread != nullptr || address != GPU_GP0) {
+    for (uint32_t i = 0; i < count; i++) {
+      write_port(address, data[i]);
+    }
+
+    return;
+  }
+
+  while (count) {
+    if (cpu_to_gpu_transfer.run.active) {
+      uint32_t n = vram_transfer_write(data, count);
+
+      data += n;
+      count -= n;
+    }
+    else {
+      gp0(*data);
+
+      data++;
+      count--;
+    }
+  }
+}
+
+
 // common functionality
 
 
-gpu_t::color_t gpu_t::uint16_to_color(uint16_t value) {
-  color_t color;
-  color.r = (value << 3) & 0xf8;
-  color.g = (value >> 2) & 0xf8;
-  color.b = (value >> 7) & 0xf8;
+static const int dither_lut[4][4] = {
+  { -4,  0, -3,  1 },
+  {  2, -2,  3, -1 },
+  { -3,  1, -4,  0 },
+  {  3, -1,  2, -2 }
+};
+
+
+static gpu_t::dither_table_t get_dither_table() {
+  gpu_t::dither_table_t table;
+
+  for (int y = 0; y < 4; y++) {
+    for (int x = 0; x < 4; x++) {
+      for (int value = 0; value < 256; value++) {
+        table.values[y][x][value] = ulimit<8>::clamp(value + dither_lut[y][x]) >> 3;
+      }
+    }
+  }
 
-  return color;
+  return table;
 }
 
 
-uint16_t gpu_t::color_to_uint16(gpu_t::color_t color) {
-  return
-    ((color.r >> 3) & 0x001f) |
-    ((color.g << 2) & 0x03e0) |
-    ((color.b << 7) & 0x7c00);
+const gpu_t::dither_table_t gpu_t::dither_table = get_dither_table();
+
+
+uint32_t gpu_t::get_raster_flags(uint32_t command, const tev_t &tev, bool dither) {
+  uint32_t flags = 0;
+
+  if (command & (1 << 26)) {
+    flags |= raster_textured;
+  }
+
+  if (command & (1 << 24)) {
+    flags |= raster_raw;
+  }
+
+  if (command & (1 << 25)) {
+    flags |= raster_blend;
+  }
+
+  if (dither) {
+    flags |= raster_dither;
+  }
+
+  flags |= (tev.color_mix_mode & 3) << raster_mode_shift;
+  flags |= (tev.texture_colors & 3) << raster_depth_shift;
+
+  return flags;
 }
 
 
-gpu_t::color_t gpu_t::get_texture_color__4bpp(gpu_t::tev_t &tev, gpu_t::point_t &coord) {
-  uint16_t texel = vram_read(
-    tev.texture_page_x + coord.x / 4,
-    tev.texture_page_y + coord.y);
+static bool spans_overlap(int32_t a0, int32_t a1, int32_t b0, int32_t b1) {
+  // rows wrap around at the bottom of vram
+
+  if (a1 - a0 >= 511 || b1 - b0 >= 511) {
+    return true;
+  }
 
-  texel = (texel >> ((coord.x & 3) * 4)) & 15;
+  int32_t shift = (a0 & ~511) - (b0 & ~511);
 
-  uint16_t pixel = vram_read(
-    tev.palette_page_x + texel,
-    tev.palette_page_y);
+  for (int32_t i = -512; i <= 512; i += 512) {
+    if (a0 <= b1 + shift + i && b0 + shift + i <= a1) {
+      return true;
+    }
+  }
 
-  return uint16_to_color(pixel);
+  return false;
 }
 
 
-gpu_t::color_t gpu_t::get_texture_color__8bpp(gpu_t::tev_t &tev, gpu_t::point_t &coord) {
-  uint16_t texel = vram_read(
-    tev.texture_page_x + coord.x / 2,
-    tev.texture_page_y + coord.y);
+static bool rects_overlap(int32_t x0, int32_t x1, int32_t y0, int32_t y1, gpu_t::point_t min, gpu_t::point_t max) {
+  if (x0 > max.x || x1 < min.x) {
+    return false;
+  }
 
-  texel = (texel >> ((coord.x & 1) * 8)) & 255;
+  return spans_overlap(y0, y1, min.y, max.y);
+}
 
-  uint16_t pixel = vram_read(
-    tev.palette_page_x + texel,
-    tev.palette_page_y);
 
-  return uint16_to_color(pixel);
+static bool area_overlaps(int32_t x, int32_t y, int32_t w, int32_t h, gpu_t::point_t min, gpu_t::point_t max) {
+  // an area running off the right edge carries on at the start of the next
+  // row.
+
+  if (x + w <= 1024) {
+    return rects_overlap(x, x + w - 1, y, y + h - 1, min, max);
+  }
+
+  return
+    rects_overlap(x, 1023, y, y + h - 1, min, max) ||
+    rects_overlap(0, x + w - 1025, y + 1, y + h, min, max);
 }
 
 
-gpu_t::color_t gpu_t::get_texture_color_15bpp(gpu_t::tev_t &tev, gpu_t::point_t &coord) {
-  uint16_t pixel = vram_read(
-    tev.texture_page_x + coord.x,
-    tev.texture_page_y + coord.y);
+bool gpu_t::samples_target(const tev_t &tev, point_t min, point_t max) {
+  // a primitive that reads what it draws has to see its own writes, so it
+  // can't go through the texture cache or the vector path.
+
+  static const int32_t page_width[4] = { 64, 128, 256, 256 };
+  static const int32_t clut_width[4] = { 16, 256, 0, 0 };
 
-  return uint16_to_color(pixel);
+  int32_t colors = tev.texture_colors;
+
+  if (area_overlaps(tev.texture_page_x, tev.texture_page_y, page_width[colors], 256, min, max)) {
+    return true;
+  }
+
+  return
+    clut_width[colors] != 0 &&
+    area_overlaps(tev.palette_page_x, tev.palette_page_y, clut_width[colors], 1, min, max);
 }
 
 
-gpu_t::color_t gpu_t::get_texture_color(gpu_t::tev_t &tev, gpu_t::point_t &coord) {
-  switch (tev.texture_colors) {
-  default:
-  case 0:
-    return get_texture_color__4bpp(tev, coord);
+void gpu_t::update_texture_window() {
+  uint32_t mask_u = texture_window_mask_x * 8;
+  uint32_t mask_v = texture_window_mask_y * 8;
+  uint32_t offset_u = (texture_window_offset_x * 8) & mask_u;
+  uint32_t offset_v = (texture_window_offset_y * 8) & mask_v;
+
+  for (uint32_t i = 0; i < 256; i++) {
+    texture_window_u[i] = uint8_t((i & ~mask_u) | offset_u);
+    texture_window_v[i] = uint8_t((i & ~mask_v) | offset_v);
+  }
+}
+
+
+gpu_t::sampler_t gpu_t::get_sampler(const tev_t &tev) {
+  sampler_t sampler;
+  sampler.texels = tev.texels;
+  sampler.vram = (const uint16_t *)vram.get_pointer(0);
+  sampler.page = (tev.texture_page_y * 1024) + tev.texture_page_x;
+  sampler.clut = (tev.palette_page_y * 1024) + tev.palette_page_x;
+  sampler.window_u = texture_window_u;
+  sampler.window_v = texture_window_v;
+
+  return sampler;
+}
 
-  case 1:
-    return get_texture_color__8bpp(tev, coord);
 
-  case 2:
-    return get_texture_color_15bpp(tev, coord);
+void gpu_t::bind_texture(tev_t &tev, point_t min, point_t max) {
+  tev.texels = nullptr;
 
-  case 3:
-    return get_texture_color_15bpp(tev, coord);
+  if (tev.texture_colors < 2 && samples_target(tev, min, max) == false) {
+    tev.texels = texture_cache.lookup(
+      *this,
+      tev.texture_colors,
+      tev.texture_page_x,
+      tev.texture_page_y,
+      tev.palette_page_x,
+      tev.palette_page_y);
   }
 }
@@ -3,8 +3,10 @@
 
 
 #include "console.hpp"
+#include "gpu/gpu-texture.hpp"
 #include "memory.hpp"
 #include "memory-component.hpp"
+#include "state.hpp"
 
 
 #define GPU_GP0  0x1f801810
@@ -13,7 +15,13 @@
 #define GPU_STAT 0x1f801814
 
 
-class gpu_t : public memory_component_t {
+class gpu_recorder_t;
+class gpu_stats_t;
+class gpu_thread_t;
+class gpu_tiles_t;
+
+
+class gpu_t final : public memory_component_t {
 
 public:
 
@@ -90,20 +98,65 @@ public:
 
   } gpu_to_cpu_transfer;
 
+  gpu_texture_cache_t texture_cache;
+
+  gpu_thread_t *thread = nullptr;
+
+  gpu_tiles_t *tiles = nullptr;
+
+  gpu_stats_t *stats = nullptr;
+
+  gpu_recorder_t *recorder = nullptr;
+
   gpu_t();
 
+  ~gpu_t();
+
+  void serialize(state_t &state);
+
+  void enable_thread();
+
+  void enable_tiles();
+
+  void enable_stats();
+
+  // records every GP0/GP1 write and GPUREAD read to a file, starting with the
+  // current state. see gpu-recorder.hpp.
+
+  bool start_recording(const char *file_name);
+
+  void stop_recording();
+
+  void sync();
+
   uint32_t io_read_word(uint32_t address);
 
   void io_write_word(uint32_t address, uint32_t data);
 
+  // the same as a run of io_read_word/io_write_word calls, for DMA
+
+  void io_read_words(uint32_t address, uint32_t *data, uint32_t count);
+
+  void io_write_words(uint32_t address, const uint32_t *data, uint32_t count);
+
   uint32_t data();
 
   uint32_t stat();
 
+  // io_write_word, without recording it
+
+  void write_port(uint32_t address, uint32_t data);
+
   void gp0(uint32_t data);
 
   void gp1(uint32_t data);
 
+  static int get_command_size(uint32_t command);
+
+  static uint32_t gp0_status(uint32_t status, uint32_t command);
+
+  static uint32_t gp1_status(uint32_t status, uint32_t data);
+
   uint32_t vram_address(int x, int y);
 
   uint16_t *vram_data(int x, int y);
@@ -112,9 +165,17 @@ public:
 
   void vram_write(int x, int y, uint16_t data);
 
-  uint16_t vram_transfer_read();
+  void vram_read_row(int x, int y, uint16_t *data, int count);
+
+  void vram_write_row(int x, int y, const uint16_t *data, int count);
+
+  void vram_fill_row(int x, int y, uint16_t color, int count);
 
-  void vram_transfer_write(uint16_t data);
+  static void apply_mask(uint16_t *data, const uint16_t *background, uint16_t mask, int count);
+
+  uint32_t vram_transfer_read(uint32_t *data, uint32_t count);
+
+  uint32_t vram_transfer_write(const uint32_t *data, uint32_t count);
 
   struct color_t {
 
@@ -143,6 +204,9 @@ public:
     int32_t texture_page_y;
     int32_t color_mix_mode;
 
+    // decoded texels from the texture cache, or null to read VRAM
+    const uint16_t *texels;
+
   };
 
   void copy_vram_to_vram();
@@ -151,7 +215,45 @@ public:
 
   void copy_vram_to_wram();
 
-  void draw_point(point_t point, color_t color);
+  // eight pixels of a row, lined up for the vector code
+
+  struct span_t {
+
+    uint8_t r[8];
+    uint8_t g[8];
+    uint8_t b[8];
+
+    // bit 15 of the texels
+    uint16_t mask[8];
+
+  };
+
+  // the mask settings from GP0(E6h), as bit 15 of a pixel
+
+  uint16_t get_mask_set() const {
+    return (status << 4) & 0x8000;
+  }
+
+  uint16_t get_mask_check() const {
+    return (status << 3) & 0x8000;
+  }
+
+  // every 8-bit channel value, dithered for each cell of the 4x4 pattern
+  // and cut down to five bits
+
+  struct dither_table_t {
+    uint8_t values[4][4][256];
+  };
+
+  static const dither_table_t dither_table;
+
+  // false if the point is outside the drawing area
+
+  template<uint32_t flags>
+  bool draw_point(point_t point, color_t color, uint16_t mask);
+
+  template<uint32_t flags>
+  void draw_span(point_t point, uint32_t lanes, const span_t &span);
 
   void draw_line();
 
@@ -163,35 +265,175 @@ public:
 
   // common functionality
 
-  color_t uint16_to_color(uint16_t value);
+  static color_t uint16_to_color(uint16_t value) {
+    color_t color;
+    color.r = (value << 3) & 0xf8;
+    color.g = (value >> 2) & 0xf8;
+    color.b = (value >> 7) & 0xf8;
+
+    return color;
+  }
 
-  uint16_t color_to_uint16(color_t color);
+  static uint16_t color_to_uint16(color_t color) {
+    return
+      ((color.r >> 3) & 0x001f) |
+      ((color.g << 2) & 0x03e0) |
+      ((color.b << 7) & 0x7c00);
+  }
 
-  color_t get_texture_color__4bpp(tev_t &tev, point_t &coord);
+  // the texture window, as a table from texture coordinate to the one
+  // that's sampled. rebuilt by GP0(E2h).
 
-  color_t get_texture_color__8bpp(tev_t &tev, point_t &coord);
+  uint8_t texture_window_u[256];
+  uint8_t texture_window_v[256];
 
-  color_t get_texture_color_15bpp(tev_t &tev, point_t &coord);
+  void update_texture_window();
 
-  color_t get_texture_color(tev_t &tev, point_t &coord);
+  // everything a pixel loop needs to fetch a texel, worked out once per
+  // primitive. 'page' and 'clut' are offsets into VRAM in halfwords, and
+  // wrap around the end of it like vram_read does.
+
+  struct sampler_t {
+    static const uint32_t wrap = (1024 * 512) - 1;
+
+    const uint16_t *texels;
+    const uint16_t *vram;
+    uint32_t page;
+    uint32_t clut;
+    const uint8_t *window_u;
+    const uint8_t *window_v;
+  };
+
+  sampler_t get_sampler(const tev_t &tev);
+
+  static bool samples_target(const tev_t &tev, point_t min, point_t max);
+
+  void bind_texture(tev_t &tev, point_t min, point_t max);
+
+  // the parts of a primitive that change what the pixel loop does. they
+  // make up the index into the rasteriser dispatch tables, see
+  // gpu-raster.hpp.
+
+  enum {
+    raster_textured = 1 << 0,
+    raster_raw = 1 << 1,
+    raster_blend = 1 << 2,
+    raster_mode_shift = 3,
+    raster_depth_shift = 5,
+    raster_dither = 1 << 7
+  };
+
+  static uint32_t get_raster_flags(uint32_t command, const tev_t &tev, bool dither);
+
+  template<uint32_t flags>
+  static uint16_t get_texel(const sampler_t &sampler, point_t coord);
+
+  // modulates a texel by the shading colour
+
+  template<uint32_t flags>
+  static color_t shade_texel(uint16_t texel, color_t shade);
+
+  // the colour of a pixel before it's blended, and bit 15 of its texel.
+  // false if the texel is transparent.
+
+  template<uint32_t flags>
+  static bool get_color(const sampler_t &sampler, color_t shade, point_t coord, color_t &color, uint16_t &mask);
 
   // rectangle drawing
 
-  bool get_color(uint32_t command, color_t &color, tev_t &tev, point_t &coord);
+  struct rectangle_t {
+    gpu_t::color_t color;
+    gpu_t::point_t coord;
+    gpu_t::point_t point;
+    gpu_t::point_t size;
+
+    // flipped rectangles step backwards through the texture
+    bool flip_x;
+    bool flip_y;
+
+    gpu_t::tev_t tev;
+  };
+
+  template<uint32_t flags>
+  static void get_texel_row(const sampler_t &sampler, int32_t u, int32_t step, int32_t v, uint16_t *texels, int32_t count);
+
+  template<uint32_t flags>
+  void draw_rectangle(rectangle_t &rectangle);
+
+  void draw_rectangle(uint32_t flags, rectangle_t &rectangle);
+
+  static bool clip_rectangle(rectangle_t &rectangle, point_t min, point_t max);
 
   // triangle drawing
 
+  // a value that changes linearly across a triangle, from the top-left of
+  // its bounding box.
+
+  struct gradient_t {
+    int32_t start;
+    int32_t dx;
+    int32_t dy;
+  };
+
   struct triangle_t {
     gpu_t::color_t colors[3];
     gpu_t::point_t coords[3];
     gpu_t::point_t points[3];
 
     gpu_t::tev_t tev;
+
+    // filled in by setup, the attributes are r, g, b, u, v in fixed point
+
+    gpu_t::point_t min;
+    gpu_t::point_t max;
+    gpu_t::gradient_t edges[3];
+    int32_t edge_bias[3];
+    gpu_t::gradient_t attributes[5];
   };
 
   void draw_triangle(gpu_t &state, uint32_t command, triangle_t &triangle);
 
-  bool get_color(uint32_t command, triangle_t &triangle, int32_t w0, int32_t w1, int32_t w2, color_t &color);
+  template<uint32_t flags>
+  void draw_triangle(triangle_t &triangle);
+
+  void draw_triangle(uint32_t flags, triangle_t &triangle);
+
+  static bool clip_triangle(triangle_t &triangle, point_t min, point_t max);
+
+  template<uint32_t flags>
+  void draw_triangle_simd(triangle_t &triangle);
+
+  // line drawing
+
+  struct line_t {
+    gpu_t::color_t colors[2];
+    gpu_t::point_t points[2];
+
+    gpu_t::tev_t tev;
+  };
+
+  // a polyline keeps taking vertices after the command, until a word that
+  // looks like 5xxx5xxxh.
+
+  struct {
+
+    bool active;
+    bool has_color;
+    uint32_t command;
+    color_t color;
+    point_t point;
+    color_t next_color;
+
+  } polyline;
+
+  static bool is_polyline_end(uint32_t data);
+
+  void draw_polyline(uint32_t data);
+
+  template<uint32_t flags>
+  void draw_line(line_t &line);
+
+  void draw_line(uint32_t flags, line_t &line);
 
 };
 
@@ -3,9 +3,13 @@
 #include "utility.hpp"
 
 
-input_t::input_t(interrupt_access_t *irq)
+input_t::input_t(interrupt_access_t *irq, scheduler_t *scheduler)
   : memory_component_t("input")
-  , irq(irq) {
+  , irq(irq)
+  , scheduler(scheduler) {
+
+  baud_event = scheduler->add([this]() { baud_elapsed(); });
+  dsr_event = scheduler->add([this]() { dsr_elapsed(); });
 
   baud_factor = 1;
   baud_reload = 0x0088;
@@ -14,6 +18,23 @@ input_t::input_t(interrupt_access_t *irq)
 }
 
 
+void input_t::serialize(state_t &state) {
+  state.io(baud_factor);
+  state.io(baud_reload);
+  state.io(baud_elapses);
+  state.io(control);
+  state.io(interrupt);
+  state.io(dsr);
+  state.io(tx_enable);
+  state.io(tx_occurring);
+  state.io(rx_enable);
+  state.io(rx_occurred);
+  state.io(tx_data);
+  state.io(rx_data);
+  state.io(ports);
+}
+
+
 uint32_t input_t::io_read_byte(uint32_t address) {
   switch (address) {
     case 0x1f801040:
@@ -64,7 +85,7 @@ uint32_t input_t::io_read_word(uint32_t address) {
         (0           << 3) | // rx_parity_error
         (dsr         << 7) |
         (interrupt   << 9) |
-        (baud_timer  << 11)
+        (get_baud_timer() << 11)
       );
   }
 
@@ -148,40 +169,58 @@ void input_t::io_write_word(uint32_t address, uint32_t data) {
 
 
 void input_t::reload_baud() {
-  baud_timer = baud_reload * baud_factor;
+  int32_t baud_timer = baud_reload * baud_factor;
+
+  if (baud_timer > 0) {
+    scheduler->schedule(baud_event, baud_timer);
+  }
+  else {
+    scheduler->cancel(baud_event);
+  }
 }
 
 
-void input_t::tick() {
-  if (dsr_cycles && !--dsr_cycles && dsr) {
-    interrupt = 1;
-    irq->send(interrupt_type_t::INPUT);
+int32_t input_t::get_baud_timer() {
+  if (scheduler->is_scheduled(baud_event)) {
+    return int32_t(scheduler->get_deadline(baud_event) - scheduler->get_time());
   }
 
-  baud_timer--;
+  return 0;
+}
 
-  if (baud_timer == 0) {
-    reload_baud();
 
-    baud_elapses++;
+void input_t::baud_elapsed() {
+  reload_baud();
 
-    if (baud_elapses == 8) {
-      baud_elapses = 0;
+  baud_elapses++;
 
-      if (tx_occurring) {
-        tx_occurring = 0;
-        rx_occurred = 1;
+  if (baud_elapses == 8) {
+    baud_elapses = 0;
 
-        dsr = send(tx_data, &rx_data);
-        dsr_cycles = 100; // delay 100 cycles before issuing an interrupt, per the documentation.
+    if (tx_occurring) {
+      tx_occurring = 0;
+      rx_occurred = 1;
 
-        log_input("transfer(0x%02x) = 0x%02x", tx_data, rx_data);
-      }
+      dsr = send(tx_data, &rx_data);
+
+      // delay 100 cycles before issuing an interrupt, per the documentation.
+
+      scheduler->schedule(dsr_event, 100);
+
+      log_input("transfer(0x%02x) = 0x%02x", tx_data, rx_data);
     }
   }
 }
 
 
+void input_t::dsr_elapsed() {
+  if (dsr) {
+    interrupt = 1;
+    irq->send(interrupt_type_t::INPUT);
+  }
+}
+
+
 input_port_t *input_t::get_selected_port() {
   if (ports[0].status == input_port_status_t::selected) {
     return &ports[0];
@@ -6,6 +6,8 @@
 #include "fifo.hpp"
 #include "interrupt-access.hpp"
 #include "memory-component.hpp"
+#include "scheduler.hpp"
+#include "state.hpp"
 
 
 enum class input_port_status_t {
@@ -38,17 +40,19 @@ class input_t : public memory_component_t {
 
   interrupt_access_t *irq;
 
+  scheduler_t *scheduler;
+
   int32_t baud_factor;
   int32_t baud_reload;
-  int32_t baud_timer;
   int32_t baud_elapses;
+  int baud_event;
 
   int32_t control;
 
   bool interrupt;
 
   bool dsr;
-  int dsr_cycles;
+  int dsr_event;
   bool tx_enable;
   bool tx_occurring;
   bool rx_enable;
@@ -60,7 +64,9 @@ class input_t : public memory_component_t {
 
 public:
 
-  input_t(interrupt_access_t *irq);
+  input_t(interrupt_access_t *irq, scheduler_t *scheduler);
+
+  void serialize(state_t &state);
 
   uint32_t io_read_byte(uint32_t address);
 
@@ -74,10 +80,14 @@ public:
 
   void io_write_word(uint32_t address, uint32_t data);
 
-  void tick();
-
   void reload_baud();
 
+  int32_t get_baud_timer();
+
+  void baud_elapsed();
+
+  void dsr_elapsed();
+
 private:
   input_port_t *get_selected_port();
 
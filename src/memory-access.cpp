@@ -0,0 +1,31 @@
+#include "memory-access.hpp"
+
+#include <cstring>
+
+
+memory_access_t::memory_access_t() {
+  read_pages = new uint8_t *[page_count];
+  write_pages = new uint8_t *[page_count];
+
+  memset(read_pages, 0, sizeof(uint8_t *) * page_count);
+  memset(write_pages, 0, sizeof(uint8_t *) * page_count);
+}
+
+
+memory_access_t::~memory_access_t() {
+  delete[] read_pages;
+  delete[] write_pages;
+}
+
+
+void memory_access_t::map_pages(uint8_t **pages, uint32_t min, uint32_t max, uint8_t *data, uint32_t size) {
+  // `size' is the size of the backing memory, which is mirrored over the
+  // whole range.
+
+  for (uint32_t address = min; address <= max; address += page_size) {
+    pages[address >> page_shift] = data != nullptr
+      ? data + ((address - min) & (size - 1))
+      : nullptr
+      ;
+  }
+}
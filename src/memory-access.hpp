@@ -5,20 +5,111 @@
 #include <cstdint>
 
 
+// Physical memory is split into 4 KiB pages. Pages backed by plain memory
+// (WRAM, BIOS, scratchpad) have a host pointer in the page table and are
+// accessed inline, everything else takes the slow path into the
+// implementation.
+
 class memory_access_t {
 public:
 
-  virtual uint32_t read_byte(uint32_t address) = 0;
+  static const int page_shift = 12;
+  static const uint32_t page_size = 1 << page_shift;
+  static const uint32_t page_mask = page_size - 1;
+  static const uint32_t page_count = 0x20000000 >> page_shift;
+
+protected:
+
+  uint8_t **read_pages;
+  uint8_t **write_pages;
+
+public:
+
+  memory_access_t();
+
+  virtual ~memory_access_t();
+
+  uint32_t read_byte(uint32_t address) {
+    if (uint8_t *page = get_read_page(address)) {
+      return page[address & page_mask];
+    }
+
+    return slow_read_byte(address);
+  }
+
+  uint32_t read_half(uint32_t address) {
+    if (uint8_t *page = get_read_page(address)) {
+      return *(uint16_t *)(page + (address & page_mask & ~1));
+    }
+
+    return slow_read_half(address);
+  }
+
+  uint32_t read_word(uint32_t address) {
+    if (uint8_t *page = get_read_page(address)) {
+      return *(uint32_t *)(page + (address & page_mask & ~3));
+    }
+
+    return slow_read_word(address);
+  }
+
+  void write_byte(uint32_t address, uint32_t data) {
+    if (uint8_t *page = get_write_page(address)) {
+      page[address & page_mask] = uint8_t(data);
+      return;
+    }
+
+    slow_write_byte(address, data);
+  }
+
+  void write_half(uint32_t address, uint32_t data) {
+    if (uint8_t *page = get_write_page(address)) {
+      *(uint16_t *)(page + (address & page_mask & ~1)) = uint16_t(data);
+      return;
+    }
+
+    slow_write_half(address, data);
+  }
+
+  void write_word(uint32_t address, uint32_t data) {
+    if (uint8_t *page = get_write_page(address)) {
+      *(uint32_t *)(page + (address & page_mask & ~3)) = data;
+      return;
+    }
+
+    slow_write_word(address, data);
+  }
+
+  // pages holding translated code are taken off the fast path for writes, so
+  // that the implementation gets to see every store into them.
+
+  virtual void protect_code(uint32_t address) = 0;
+
+  virtual void unprotect_code(uint32_t address) = 0;
+
+protected:
+
+  uint8_t *get_read_page(uint32_t address) {
+    return (address < 0x20000000) ? read_pages[address >> page_shift] : nullptr;
+  }
+
+  uint8_t *get_write_page(uint32_t address) {
+    return (address < 0x20000000) ? write_pages[address >> page_shift] : nullptr;
+  }
+
+  void map_pages(uint8_t **pages, uint32_t min, uint32_t max, uint8_t *data, uint32_t size);
+
+  virtual uint32_t slow_read_byte(uint32_t address) = 0;
 
-  virtual uint32_t read_half(uint32_t address) = 0;
+  virtual uint32_t slow_read_half(uint32_t address) = 0;
 
-  virtual uint32_t read_word(uint32_t address) = 0;
+  virtual uint32_t slow_read_word(uint32_t address) = 0;
 
-  virtual void write_byte(uint32_t address, uint32_t data) = 0;
+  virtual void slow_write_byte(uint32_t address, uint32_t data) = 0;
 
-  virtual void write_half(uint32_t address, uint32_t data) = 0;
+  virtual void slow_write_half(uint32_t address, uint32_t data) = 0;
 
-  virtual void write_word(uint32_t address, uint32_t data) = 0;
+  virtual void slow_write_word(uint32_t address, uint32_t data) = 0;
 };
 
 
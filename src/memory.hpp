@@ -6,6 +6,7 @@
 #include <cstring>
 #include <cstdio>
 #include "memory-component.hpp"
+#include "state.hpp"
 
 
 constexpr uint32_t kib(uint32_t x) { return 1024 * x; }
@@ -58,6 +59,10 @@ struct memory_t : public memory_component_t {
     w[(address & mask) / 4] = data;
   }
 
+  void serialize(state_t &state) {
+    state.io(b, size_t(size));
+  }
+
   bool load_blob(const char *filename) {
     if (FILE* file = fopen(filename, "rb+")) {
       fread(b, sizeof(uint8_t), size, file);
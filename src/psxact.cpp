@@ -1,5 +1,7 @@
 #include <cstdio>
+#include <cstdlib>
 #include "console.hpp"
+#include "cpu/cpu.hpp"
 #include "sdl2.hpp"
 
 
@@ -10,6 +12,14 @@ struct app_context_t {
 
   const char *bios_file_name = "bios.rom";
   const char *game_file_name = "";
+  const char *exe_file_name = nullptr;
+  const char *boot_cache_directory = nullptr;
+  cpu_mode_t cpu_mode = cpu_mode_t::interpreter;
+  bool gpu_thread = false;
+  bool gpu_tiles = false;
+  bool gpu_stats = false;
+  int gpu_stats_every = 0;
+  const char *gpu_record_file_name = nullptr;
   bool log_counter;
   bool log_cpu;
   bool log_dma;
@@ -25,6 +35,15 @@ static void usage() {
   printf("Usage:\n");
   printf("$ psxact [--game <file>]\n");
   printf("         [--bios <file>]\n");
+  printf("         [--bios-hle]\n");
+  printf("         [--exe <file>]\n");
+  printf("         [--boot-cache <directory>]\n");
+  printf("         [--cpu <interpreter|cached|recompiler>]\n");
+  printf("         [--gpu-thread]\n");
+  printf("         [--gpu-tiles]\n");
+  printf("         [--gpu-stats]\n");
+  printf("         [--gpu-stats-every <frames>]\n");
+  printf("         [--gpu-record <file>]\n");
   printf("         [--log-counter]\n");
   printf("         [--log-cpu]\n");
   printf("         [--log-dma]\n");
@@ -70,6 +89,91 @@ static int parse_args(int argc, char *argv[], app_context_t *ctx) {
         ctx->bios_file_name = *argv;
       }
     }
+    else if (strcmp(*argv, "--exe") == 0) {
+      if (argc <= 1) {
+        printf("No value specified for `--exe'.\n");
+        return 1;
+      }
+      else {
+        argc--;
+        argv++;
+        ctx->exe_file_name = *argv;
+      }
+    }
+    else if (strcmp(*argv, "--boot-cache") == 0) {
+      if (argc <= 1) {
+        printf("No value specified for `--boot-cache'.\n");
+        return 1;
+      }
+      else {
+        argc--;
+        argv++;
+        ctx->boot_cache_directory = *argv;
+      }
+    }
+    else if (strcmp(*argv, "--bios-hle") == 0) {
+      ctx->bios_file_name = nullptr;
+    }
+    else if (strcmp(*argv, "--cpu") == 0) {
+      if (argc <= 1) {
+        printf("No value specified for `--cpu'.\n");
+        return 1;
+      }
+
+      argc--;
+      argv++;
+
+      if (strcmp(*argv, "interpreter") == 0) {
+        ctx->cpu_mode = cpu_mode_t::interpreter;
+      }
+      else if (strcmp(*argv, "cached") == 0) {
+        ctx->cpu_mode = cpu_mode_t::cached_interpreter;
+      }
+      else if (strcmp(*argv, "recompiler") == 0) {
+        ctx->cpu_mode = cpu_mode_t::recompiler;
+      }
+      else {
+        printf("Unknown CPU mode: %s\n", *argv);
+        return 1;
+      }
+    }
+    else if (strcmp(*argv, "--gpu-thread") == 0) {
+      ctx->gpu_thread = 1;
+    }
+    else if (strcmp(*argv, "--gpu-tiles") == 0) {
+      ctx->gpu_tiles = 1;
+    }
+    else if (strcmp(*argv, "--gpu-stats") == 0) {
+      ctx->gpu_stats = 1;
+    }
+    else if (strcmp(*argv, "--gpu-stats-every") == 0) {
+      if (argc <= 1) {
+        printf("No value specified for `--gpu-stats-every'.\n");
+        return 1;
+      }
+
+      argc--;
+      argv++;
+
+      ctx->gpu_stats = 1;
+      ctx->gpu_stats_every = atoi(*argv);
+
+      if (ctx->gpu_stats_every <= 0) {
+        printf("Invalid frame count: %s\n", *argv);
+        return 1;
+      }
+    }
+    else if (strcmp(*argv, "--gpu-record") == 0) {
+      if (argc <= 1) {
+        printf("No value specified for `--gpu-record'.\n");
+        return 1;
+      }
+
+      argc--;
+      argv++;
+
+      ctx->gpu_record_file_name = *argv;
+    }
     else if (strcmp(*argv, "--log-counter") == 0) {
       ctx->log_counter = 1;
     }
@@ -111,9 +215,35 @@ int main(int argc, char *argv[]) {
 
   console = new console_t(
     ctx.bios_file_name,
-    ctx.game_file_name
+    ctx.game_file_name,
+    ctx.exe_file_name
   );
 
+  console->set_cpu_mode(ctx.cpu_mode);
+
+  if (ctx.gpu_thread) {
+    console->enable_gpu_thread();
+  }
+
+  if (ctx.gpu_tiles) {
+    console->enable_gpu_tiles();
+  }
+
+  if (ctx.gpu_stats) {
+    console->enable_gpu_stats(ctx.gpu_stats_every);
+  }
+
+  if (ctx.boot_cache_directory != nullptr && ctx.bios_file_name != nullptr) {
+    console->enable_boot_cache(ctx.boot_cache_directory);
+  }
+
+  // after the boot cache, so a restored state is where the recording starts
+
+  if (ctx.gpu_record_file_name != nullptr && console->start_gpu_recording(ctx.gpu_record_file_name) == false) {
+    printf("Unable to open `%s' for recording.\n", ctx.gpu_record_file_name);
+    return 1;
+  }
+
   sdl2 renderer;
 
   uint16_t *vram;
@@ -125,5 +255,8 @@ int main(int argc, char *argv[]) {
   }
   while (renderer.render(vram, w, h));
 
+  console->report_gpu_stats();
+  console->stop_gpu_recording();
+
   return 0;
 }
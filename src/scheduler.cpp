@@ -0,0 +1,184 @@
+#include "scheduler.hpp"
+
+#include <cassert>
+#include <limits>
+#include <utility>
+
+
+scheduler_t::scheduler_t()
+  : time(0)
+  , next_deadline(std::numeric_limits<int64_t>::max()) {
+}
+
+
+int scheduler_t::add(handler_t handler) {
+  event_t event;
+  event.handler = handler;
+  event.deadline = 0;
+  event.position = -1;
+
+  events.push_back(event);
+
+  return int(events.size() - 1);
+}
+
+
+void scheduler_t::schedule(int id, int64_t delay) {
+  assert(delay >= 0);
+
+  auto &event = events[id];
+
+  if (event.position != -1) {
+    remove(event.position);
+  }
+
+  event.deadline = time + delay;
+  event.position = int(heap.size());
+
+  heap.push_back(id);
+  sift_up(event.position);
+
+  update_next_deadline();
+}
+
+
+void scheduler_t::cancel(int id) {
+  auto &event = events[id];
+
+  if (event.position != -1) {
+    remove(event.position);
+    update_next_deadline();
+  }
+}
+
+
+bool scheduler_t::is_scheduled(int id) const {
+  return events[id].position != -1;
+}
+
+
+int64_t scheduler_t::get_deadline(int id) const {
+  return events[id].deadline;
+}
+
+
+void scheduler_t::serialize(state_t &state) {
+  // handlers can't be saved, but every component registers its events in
+  // the same order, so the ids line up between runs.
+
+  state.io(time);
+
+  for (int id = 0; id < int(events.size()); id++) {
+    bool scheduled = is_scheduled(id);
+    int64_t deadline = events[id].deadline;
+
+    state.io(scheduled);
+    state.io(deadline);
+
+    if (state.is_loading()) {
+      cancel(id);
+
+      if (scheduled) {
+        schedule(id, deadline - time);
+      }
+    }
+  }
+
+  update_next_deadline();
+}
+
+
+void scheduler_t::dispatch() {
+  int64_t now = time;
+
+  while (heap.size() && events[heap[0]].deadline <= now) {
+    int id = heap[0];
+    auto &event = events[id];
+
+    remove(0);
+    update_next_deadline();
+
+    // handlers see the time their event was due, so that anything they
+    // schedule is relative to it and periodic events don't drift.
+
+    time = event.deadline;
+    event.handler();
+  }
+
+  time = now;
+}
+
+
+void scheduler_t::remove(int position) {
+  int last = int(heap.size() - 1);
+
+  events[heap[position]].position = -1;
+
+  if (position != last) {
+    heap[position] = heap[last];
+    events[heap[position]].position = position;
+    heap.pop_back();
+
+    sift_up(position);
+    sift_down(position);
+  }
+  else {
+    heap.pop_back();
+  }
+}
+
+
+void scheduler_t::sift_up(int position) {
+  while (position > 0) {
+    int parent = (position - 1) / 2;
+
+    if (events[heap[parent]].deadline <= events[heap[position]].deadline) {
+      break;
+    }
+
+    swap(parent, position);
+    position = parent;
+  }
+}
+
+
+void scheduler_t::sift_down(int position) {
+  int size = int(heap.size());
+
+  while (true) {
+    int smallest = position;
+    int l = (position * 2) + 1;
+    int r = (position * 2) + 2;
+
+    if (l < size && events[heap[l]].deadline < events[heap[smallest]].deadline) {
+      smallest = l;
+    }
+
+    if (r < size && events[heap[r]].deadline < events[heap[smallest]].deadline) {
+      smallest = r;
+    }
+
+    if (smallest == position) {
+      break;
+    }
+
+    swap(smallest, position);
+    position = smallest;
+  }
+}
+
+
+void scheduler_t::swap(int a, int b) {
+  std::swap(heap[a], heap[b]);
+
+  events[heap[a]].position = a;
+  events[heap[b]].position = b;
+}
+
+
+void scheduler_t::update_next_deadline() {
+  next_deadline = heap.size()
+    ? events[heap[0]].deadline
+    : std::numeric_limits<int64_t>::max()
+    ;
+}
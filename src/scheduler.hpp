@@ -0,0 +1,82 @@
+#ifndef __psxact_scheduler__
+#define __psxact_scheduler__
+
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "state.hpp"
+
+
+// Components register an event once, at construction, and get back an id
+// that stays the same for the life of the console. Deadlines are kept in a
+// binary heap ordered by time, measured in system ticks (two per cpu cycle).
+
+class scheduler_t {
+public:
+
+  typedef std::function<void()> handler_t;
+
+private:
+
+  struct event_t {
+    handler_t handler;
+    int64_t deadline;
+    int position;
+  };
+
+  std::vector<event_t> events;
+  std::vector<int> heap;
+
+  int64_t time;
+  int64_t next_deadline;
+
+public:
+
+  scheduler_t();
+
+  int add(handler_t handler);
+
+  void schedule(int id, int64_t delay);
+
+  void cancel(int id);
+
+  bool is_scheduled(int id) const;
+
+  int64_t get_deadline(int id) const;
+
+  void serialize(state_t &state);
+
+  int64_t get_time() const {
+    return time;
+  }
+
+  int64_t get_next_deadline() const {
+    return next_deadline;
+  }
+
+  void tick(int64_t amount) {
+    time += amount;
+
+    if (time >= next_deadline) {
+      dispatch();
+    }
+  }
+
+private:
+
+  void dispatch();
+
+  void remove(int position);
+
+  void sift_up(int position);
+
+  void sift_down(int position);
+
+  void swap(int a, int b);
+
+  void update_next_deadline();
+};
+
+
+#endif // __psxact_scheduler__
@@ -10,6 +10,33 @@ spu_t::spu_t()
 }
 
 
+void spu_t::serialize(state_t &state) {
+  sound_ram.serialize(state);
+
+  state.io(control);
+  state.io(status);
+  state.io(registers);
+  state.io(sound_ram_address);
+  state.io(sound_ram_address_latch);
+  state.io(sound_ram_transfer_control);
+  state.io(cd_input_volume_left);
+  state.io(cd_input_volume_right);
+  state.io(external_input_volume_left);
+  state.io(external_input_volume_right);
+  state.io(current_main_volume_left);
+  state.io(current_main_volume_right);
+  state.io(main_volume_left);
+  state.io(main_volume_right);
+  state.io(echo_on);
+  state.io(key_on);
+  state.io(key_off);
+  state.io(noise_on);
+  state.io(pitch_modulation_on);
+  state.io(voice_status);
+  state.io(reverb);
+}
+
+
 uint32_t spu_t::io_read_half(uint32_t address) {
   if (address >= 0x1f801c00 && address <= 0x1f801d7f) {
     auto n = (address >> 4) & 31;
@@ -5,6 +5,7 @@
 #include "console.hpp"
 #include "memory.hpp"
 #include "memory-component.hpp"
+#include "state.hpp"
 
 
 class spu_t : public memory_component_t {
@@ -46,6 +47,8 @@ public:
 
   spu_t();
 
+  void serialize(state_t &state);
+
   uint32_t io_read_half(uint32_t address);
 
   void io_write_half(uint32_t address, uint32_t data);
@@ -0,0 +1,96 @@
+#include "state.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+
+state_t::state_t()
+  : position(0)
+  , loading(false)
+  , valid(true) {
+}
+
+
+bool state_t::is_loading() const {
+  return loading;
+}
+
+
+bool state_t::is_valid() const {
+  return valid;
+}
+
+
+size_t state_t::get_size() const {
+  return data.size();
+}
+
+
+const uint8_t *state_t::get_data() const {
+  return data.data();
+}
+
+
+void state_t::rewind() {
+  position = 0;
+  loading = true;
+}
+
+
+void state_t::io(void *value, size_t size) {
+  if (loading == false) {
+    const uint8_t *bytes = (const uint8_t *)value;
+    data.insert(data.end(), bytes, bytes + size);
+    return;
+  }
+
+  // a short snapshot leaves the rest of the state alone, the caller finds
+  // out through `is_valid'.
+
+  if (position + size > data.size()) {
+    valid = false;
+    return;
+  }
+
+  memcpy(value, &data[position], size);
+  position += size;
+}
+
+
+bool state_t::load(const char *file_name) {
+  FILE *file = fopen(file_name, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  fseek(file, 0, SEEK_END);
+  data.resize(size_t(ftell(file)));
+  fseek(file, 0, SEEK_SET);
+
+  bool result = fread(data.data(), 1, data.size(), file) == data.size();
+  fclose(file);
+
+  rewind();
+
+  return result;
+}
+
+
+void state_t::load(const uint8_t *bytes, size_t size) {
+  data.assign(bytes, bytes + size);
+
+  rewind();
+}
+
+
+bool state_t::save(const char *file_name) const {
+  FILE *file = fopen(file_name, "wb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  bool result = fwrite(data.data(), 1, data.size(), file) == data.size();
+  fclose(file);
+
+  return result;
+}
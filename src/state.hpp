@@ -0,0 +1,50 @@
+#ifndef __psxact_state__
+#define __psxact_state__
+
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+// A flat snapshot of the machine. Components describe their state once, in
+// `serialize', and the same code both saves and restores it: `io' copies a
+// value into the snapshot or back out of it depending on the direction.
+
+class state_t {
+
+  std::vector<uint8_t> data;
+  size_t position;
+  bool loading;
+  bool valid;
+
+public:
+
+  state_t();
+
+  bool is_loading() const;
+
+  bool is_valid() const;
+
+  size_t get_size() const;
+
+  const uint8_t *get_data() const;
+
+  void rewind();
+
+  template<typename T>
+  void io(T &value) {
+    io(&value, sizeof(T));
+  }
+
+  void io(void *value, size_t size);
+
+  bool load(const char *file_name);
+
+  void load(const uint8_t *bytes, size_t size);
+
+  bool save(const char *file_name) const;
+};
+
+
+#endif // __psxact_state__
@@ -0,0 +1,216 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "gpu/gpu.hpp"
+#include "gpu/gpu-recorder.hpp"
+#include "gpu/gpu-stats.hpp"
+
+
+// Replays a file written by --gpu-record into a fresh gpu_t, as fast as it
+// will go, and reports how long it took. The VRAM hash at the end is the
+// same from run to run, so it doubles as a regression test for the
+// rasterizer.
+
+
+struct app_context_t {
+
+  const char *file_name = nullptr;
+  bool gpu_thread = false;
+  bool gpu_tiles = false;
+
+};
+
+
+static void usage() {
+  printf("Usage:\n");
+  printf("$ psxact-gpu-replay [--gpu-thread]\n");
+  printf("                    [--gpu-tiles]\n");
+  printf("                    <file>\n");
+}
+
+
+static int parse_args(int argc, char *argv[], app_context_t *ctx) {
+  while (true) {
+    argc--;
+    argv++;
+
+    if (argc == 0) {
+      break;
+    }
+
+    if (strcmp(*argv, "--gpu-thread") == 0) {
+      ctx->gpu_thread = 1;
+    }
+    else if (strcmp(*argv, "--gpu-tiles") == 0) {
+      ctx->gpu_tiles = 1;
+    }
+    else if (**argv == '-' || ctx->file_name != nullptr) {
+      printf("Unknown option: %s\n", *argv);
+      return 1;
+    }
+    else {
+      ctx->file_name = *argv;
+    }
+  }
+
+  return ctx->file_name == nullptr;
+}
+
+
+static bool load_file(const char *file_name, std::vector<uint32_t> &words) {
+  FILE *file = fopen(file_name, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  fseek(file, 0, SEEK_END);
+  words.resize(size_t(ftell(file)) / sizeof(uint32_t));
+  fseek(file, 0, SEEK_SET);
+
+  bool result = fread(words.data(), sizeof(uint32_t), words.size(), file) == words.size();
+  fclose(file);
+
+  return result;
+}
+
+
+// returns false if the recording is cut short or damaged
+
+static bool replay(gpu_t &gpu, const std::vector<uint32_t> &words) {
+  const uint32_t *data = words.data();
+  size_t size = words.size();
+  size_t index = 2;
+
+  std::vector<uint32_t> buffer;
+
+  while (index < size) {
+    uint32_t type = words[index] >> 28;
+    uint32_t count = words[index] & gpu_recorder_t::count_mask;
+    index++;
+
+    switch (type) {
+      case gpu_recorder_t::record_gp0:
+      case gpu_recorder_t::record_gp1:
+        if (count > size - index) {
+          return false;
+        }
+
+        gpu.io_write_words(type == gpu_recorder_t::record_gp0 ? GPU_GP0 : GPU_GP1, &data[index], count);
+        index += count;
+        break;
+
+      case gpu_recorder_t::record_read:
+        buffer.resize(count);
+        gpu.io_read_words(GPU_READ, buffer.data(), count);
+        break;
+
+      case gpu_recorder_t::record_frame:
+        gpu.sync();
+        gpu.stats->frames++;
+        break;
+
+      case gpu_recorder_t::record_state: {
+        size_t length = (count + 3) / 4;
+
+        if (length > size - index) {
+          return false;
+        }
+
+        state_t state;
+        state.load((const uint8_t *)&data[index], count);
+
+        gpu.serialize(state);
+
+        if (state.is_valid() == false) {
+          return false;
+        }
+
+        index += length;
+        break;
+      }
+
+      default:
+        return false;
+    }
+  }
+
+  gpu.sync();
+
+  return true;
+}
+
+
+static uint64_t get_vram_hash(gpu_t &gpu) {
+  const uint8_t *bytes = (const uint8_t *)gpu.vram.get_pointer(0);
+  uint64_t hash = 0xcbf29ce484222325;
+
+  for (uint32_t i = 0; i < mib(1); i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3;
+  }
+
+  return hash;
+}
+
+
+int main(int argc, char *argv[]) {
+  app_context_t ctx;
+
+  if (parse_args(argc, argv, &ctx)) {
+    usage();
+    return 1;
+  }
+
+  std::vector<uint32_t> words;
+
+  if (load_file(ctx.file_name, words) == false) {
+    printf("Unable to read `%s'.\n", ctx.file_name);
+    return 1;
+  }
+
+  if (words.size() < 2 ||
+      words[0] != gpu_recorder_t::magic ||
+      words[1] != gpu_recorder_t::version) {
+    printf("`%s' isn't a recording this version can replay.\n", ctx.file_name);
+    return 1;
+  }
+
+  gpu_t *gpu = new gpu_t();
+
+  if (ctx.gpu_thread) {
+    gpu->enable_thread();
+  }
+
+  if (ctx.gpu_tiles) {
+    gpu->enable_tiles();
+  }
+
+  gpu->enable_stats();
+
+  auto start = std::chrono::steady_clock::now();
+
+  bool complete = replay(*gpu, words);
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  if (complete == false) {
+    printf("`%s' is cut short or damaged, stopped early.\n", ctx.file_name);
+  }
+
+  uint32_t frames = gpu->stats->frames;
+
+  printf("%u frames in %.3f seconds, %.1f frames per second\n",
+    frames,
+    seconds,
+    seconds > 0 ? frames / seconds : 0.0);
+
+  printf("vram hash: %016llx\n", (unsigned long long)get_vram_hash(*gpu));
+
+  gpu->stats->print();
+
+  // stops the render thread and tile workers
+
+  delete gpu;
+
+  return complete ? 0 : 1;
+}